@@ -0,0 +1,265 @@
+/*****************************************************
+ * FSView layout and paint benchmark
+ *
+ * Lays out and paints TreeMapItem trees of given shape
+ * into a QImage. Run with QT_QPA_PLATFORM=offscreen on
+ * machines without display. Results are written as JSON.
+ */
+
+#include "treemap.h"
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTextStream>
+
+#include <math.h>
+
+/* Deterministic random numbers (xorshift64*) */
+class Random
+{
+public:
+    explicit Random(quint64 seed)
+    {
+        _state = seed ? seed : 1;
+    }
+
+    quint64 next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 2685821657736338717ULL;
+    }
+    int range(int n)
+    {
+        return (n > 0) ? (int)(next() % (quint64)n) : 0;
+    }
+
+private:
+    quint64 _state;
+};
+
+static TreeMapItem *newItem(TreeMapItem *parent, double value, int no)
+{
+    TreeMapItem *i = new TreeMapItem(parent, value);
+    i->setText(0, QStringLiteral("item%1").arg(no));
+    i->setText(1, QString::number(value, 'f', 0));
+    return i;
+}
+
+// sort like FSView, once the tree is complete
+static void sortTree(TreeMapItem *i)
+{
+    i->setSorting(-2, false);
+    if (i->children()) {
+        foreach (TreeMapItem *c, *i->children()) {
+            sortTree(c);
+        }
+    }
+}
+
+/* Builds the tree of shape <shape> below <base>,
+ * returns the number of items */
+static int buildTree(TreeMapItem *base, const QString &shape, int count, quint64 seed)
+{
+    Random random(seed);
+    int items = 0;
+
+    if (shape == QLatin1String("flat")) {
+        // one directory with <count> files
+        for (int i = 0; i < count; i++) {
+            newItem(base, 1 + random.range(1000), items++);
+        }
+    } else if (shape == QLatin1String("deep")) {
+        // chain of <count> levels, with a sibling on each
+        TreeMapItem *p = base;
+        for (int i = 0; i < count; i++) {
+            newItem(p, 1 + random.range(100), items++);
+            p = newItem(p, count - i, items++);
+        }
+    } else {
+        // "zipf": fan-out 10, sizes by Zipf's law over a random rank
+        QList<TreeMapItem *> level;
+        level.append(base);
+        while (items < count) {
+            QList<TreeMapItem *> next;
+            foreach (TreeMapItem *p, level) {
+                for (int i = 0; i < 10 && items < count; i++) {
+                    int rank = 1 + random.range(count);
+                    next.append(newItem(p, 1e6 / rank, items++));
+                }
+            }
+            level = next;
+        }
+    }
+
+    sortTree(base);
+    return items;
+}
+
+/* Time for a full layout and paint with the current settings,
+ * best of <repeat> runs, in microseconds */
+static qint64 paintTime(TreeMapWidget *w, QImage &image, int repeat)
+{
+    qint64 best = -1;
+    for (int i = 0; i < repeat; i++) {
+        QElapsedTimer timer;
+        timer.start();
+        w->redraw();
+        w->render(&image);
+        qint64 t = timer.nsecsElapsed() / 1000;
+        if (best < 0 || t < best) {
+            best = t;
+        }
+    }
+    return best;
+}
+
+static qint64 hitTestTime(TreeMapWidget *w, int points, int &hits)
+{
+    int side = qMax(1, (int)sqrt((double)points));
+    hits = 0;
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int y = 0; y < side; y++) {
+        for (int x = 0; x < side; x++) {
+            if (w->item(x * w->width() / side, y * w->height() / side)) {
+                hits++;
+            }
+        }
+    }
+    return timer.nsecsElapsed() / 1000;
+}
+
+static void setFields(TreeMapWidget *w, bool visible)
+{
+    w->setFieldVisible(0, visible);
+    w->setFieldVisible(1, visible);
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("TreeMapWidget layout and paint benchmark"));
+    parser.addHelpOption();
+
+    QCommandLineOption shapeOption(QStringLiteral("shape"), QStringLiteral("Tree shapes: flat, deep, zipf"), QStringLiteral("list"), QStringLiteral("flat,deep,zipf"));
+    QCommandLineOption flatOption(QStringLiteral("flat-count"), QStringLiteral("Children of the flat tree"), QStringLiteral("n"), QStringLiteral("1000000"));
+    QCommandLineOption deepOption(QStringLiteral("deep-count"), QStringLiteral("Depth of the deep tree"), QStringLiteral("n"), QStringLiteral("1000"));
+    QCommandLineOption zipfOption(QStringLiteral("zipf-count"), QStringLiteral("Items of the zipf tree"), QStringLiteral("n"), QStringLiteral("100000"));
+    QCommandLineOption sizeOption(QStringLiteral("sizes"), QStringLiteral("Image sizes"), QStringLiteral("list"), QStringLiteral("320x240,1280x720,3840x2160"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Runs per measurement"), QStringLiteral("n"), QStringLiteral("3"));
+    QCommandLineOption hitOption(QStringLiteral("hit-tests"), QStringLiteral("Number of hit tests"), QStringLiteral("n"), QStringLiteral("10000"));
+    QCommandLineOption seedOption(QStringLiteral("seed"), QStringLiteral("Random seed"), QStringLiteral("n"), QStringLiteral("1"));
+    QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write JSON to file instead of stdout"), QStringLiteral("file"));
+    parser.addOption(shapeOption);
+    parser.addOption(flatOption);
+    parser.addOption(deepOption);
+    parser.addOption(zipfOption);
+    parser.addOption(sizeOption);
+    parser.addOption(repeatOption);
+    parser.addOption(hitOption);
+    parser.addOption(seedOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    int repeat = qMax(1, parser.value(repeatOption).toInt());
+    int hitTests = parser.value(hitOption).toInt();
+    quint64 seed = parser.value(seedOption).toULongLong();
+
+    QList<QSize> sizes;
+    foreach (const QString &s, parser.value(sizeOption).split(',')) {
+        QStringList wh = s.split('x');
+        if (wh.count() == 2) {
+            sizes.append(QSize(wh[0].toInt(), wh[1].toInt()));
+        }
+    }
+
+    QJsonArray runs;
+    foreach (const QString &shape, parser.value(shapeOption).split(',')) {
+        int count = parser.value(shape == QLatin1String("flat") ? flatOption :
+                                 shape == QLatin1String("deep") ? deepOption :
+                                 zipfOption).toInt();
+
+        QElapsedTimer timer;
+        timer.start();
+        TreeMapWidget w(new TreeMapItem);
+        int items = buildTree(w.base(), shape, count, seed);
+        qint64 buildTime = timer.nsecsElapsed() / 1000;
+
+        // draw everything in one frame
+        w.setProgressiveDrawing(false);
+        w.setMaxDrawingDepth(-1);
+        w.show();
+
+        foreach (const QSize &size, sizes) {
+            w.resize(size);
+            QImage image(size, QImage::Format_ARGB32_Premultiplied);
+
+            for (int m = TreeMapItem::Bisection; m <= TreeMapItem::Vertical; m++) {
+                w.setSplitMode((TreeMapItem::SplitMode)m);
+
+                // each step adds one part of the drawing
+                w.setBackgroundEnabled(false);
+                w.setShadingEnabled(false);
+                setFields(&w, false);
+                qint64 layout = paintTime(&w, image, repeat);
+                w.setBackgroundEnabled(true);
+                qint64 background = paintTime(&w, image, repeat);
+                w.setShadingEnabled(true);
+                qint64 shading = paintTime(&w, image, repeat);
+                setFields(&w, true);
+                qint64 full = paintTime(&w, image, repeat);
+
+                int hits;
+                qint64 hitTime = hitTestTime(&w, hitTests, hits);
+
+                QJsonObject o;
+                o[QStringLiteral("shape")] = shape;
+                o[QStringLiteral("items")] = items;
+                o[QStringLiteral("build_us")] = buildTime;
+                o[QStringLiteral("width")] = size.width();
+                o[QStringLiteral("height")] = size.height();
+                o[QStringLiteral("split_mode")] = w.splitModeString();
+                o[QStringLiteral("layout_us")] = layout;
+                o[QStringLiteral("background_us")] = background - layout;
+                o[QStringLiteral("shading_us")] = shading - background;
+                o[QStringLiteral("fields_us")] = full - shading;
+                o[QStringLiteral("total_us")] = full;
+                o[QStringLiteral("hit_tests")] = hits;
+                o[QStringLiteral("hit_test_us")] = hitTime;
+                runs.append(o);
+            }
+        }
+    }
+
+    QJsonObject result;
+    result[QStringLiteral("benchmark")] = QStringLiteral("layout");
+    result[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    result[QStringLiteral("platform")] = QGuiApplication::platformName();
+    result[QStringLiteral("repeat")] = repeat;
+    result[QStringLiteral("runs")] = runs;
+
+    QByteArray json = QJsonDocument(result).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile f(parser.value(outputOption));
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+            QTextStream(stderr) << "layoutbench: can not write " << f.fileName() << endl;
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,494 @@
+/*****************************************************
+ * FSView scan benchmark
+ *
+ * Creates a synthetic directory tree and measures
+ * ScanManager on it. Results are written as JSON.
+ */
+
+#include "scan.h"
+#include "treemaplayout.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QDateTime>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringList>
+#include <QTemporaryDir>
+#include <QTextStream>
+#include <qplatformdefs.h>
+
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+/* Deterministic random numbers (xorshift64*), independent of
+ * the Qt and libc version so trees are equal between runs */
+class Random
+{
+public:
+    explicit Random(quint64 seed)
+    {
+        _state = seed ? seed : 1;
+    }
+
+    quint64 next()
+    {
+        _state ^= _state >> 12;
+        _state ^= _state << 25;
+        _state ^= _state >> 27;
+        return _state * 2685821657736338717ULL;
+    }
+    // in [0, 1)
+    double real()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    int range(int n)
+    {
+        return (n > 0) ? (int)(next() % (quint64)n) : 0;
+    }
+
+private:
+    quint64 _state;
+};
+
+/* Shape of the synthetic tree */
+struct TreeShape {
+    TreeShape()
+    {
+        seed = 1;
+        fanout = 8;
+        depth = 4;
+        files = 20;
+        distribution = QStringLiteral("uniform");
+        nameLength = 12;
+        maxFileSize = 64 * 1024;
+        hardLinks = 0.0;
+        sparse = 0.0;
+        writeData = true;
+    }
+
+    quint64 seed;
+    int fanout, depth, files;
+    // files per directory: "fixed", "uniform" or "zipf"
+    QString distribution;
+    int nameLength;
+    qint64 maxFileSize;
+    // fraction of files which are hard links / sparse
+    double hardLinks, sparse;
+    bool writeData;
+};
+
+/**
+ * Materializes a TreeShape below a directory, e.g. on a tmpfs or a
+ * loop-mounted image. Equal shapes give equal trees.
+ */
+class TreeGenerator
+{
+public:
+    explicit TreeGenerator(const TreeShape &s)
+        : _shape(s), _random(s.seed)
+    {
+        _dirs = 0;
+        _files = 0;
+        _links = 0;
+        _bytes = 0;
+        _errors = 0;
+    }
+
+    void generate(const QString &root)
+    {
+        _data = QByteArray(64 * 1024, 'x');
+        generateDir(root, 0);
+    }
+
+    qint64 dirs() const
+    {
+        return _dirs;
+    }
+    qint64 files() const
+    {
+        return _files;
+    }
+    qint64 links() const
+    {
+        return _links;
+    }
+    qint64 bytes() const
+    {
+        return _bytes;
+    }
+    qint64 errors() const
+    {
+        return _errors;
+    }
+
+private:
+    QString name()
+    {
+        static const char chars[] = "abcdefghijklmnopqrstuvwxyz0123456789_-.";
+        // lengths vary around the configured mean
+        int len = 1 + _random.range(2 * _shape.nameLength);
+        QString n;
+        n.reserve(len + 8);
+        for (int i = 0; i < len; i++) {
+            n += QLatin1Char(chars[_random.range(sizeof(chars) - 1)]);
+        }
+        return n;
+    }
+
+    int fileCount()
+    {
+        if (_shape.distribution == QLatin1String("fixed")) {
+            return _shape.files;
+        }
+        if (_shape.distribution == QLatin1String("zipf")) {
+            // Pareto with alpha 1.2: few directories with many files
+            double r = 1.0 - _random.real();
+            double n = _shape.files / 6.0 / pow(r, 1.0 / 1.2);
+            return (int)qMin(n, 100.0 * _shape.files);
+        }
+        return _random.range(2 * _shape.files + 1);
+    }
+
+    qint64 fileSize()
+    {
+        // log-uniform: many small and few large files
+        return (qint64)pow((double)_shape.maxFileSize, _random.real());
+    }
+
+    void createFile(const QString &path)
+    {
+        QByteArray p = QFile::encodeName(path);
+
+        if (!_linkTargets.isEmpty() && _random.real() < _shape.hardLinks) {
+            const QByteArray &target = _linkTargets[_random.range(_linkTargets.count())];
+            if (::link(target.constData(), p.constData()) == 0) {
+                _links++;
+            } else {
+                _errors++;
+            }
+            return;
+        }
+
+        int fd = QT_OPEN(p.constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            _errors++;
+            return;
+        }
+
+        qint64 size = fileSize();
+        if (!_shape.writeData || _random.real() < _shape.sparse) {
+            // no blocks allocated
+            if (QT_FTRUNCATE(fd, size) != 0) {
+                _errors++;
+            }
+        } else {
+            qint64 left = size;
+            while (left > 0) {
+                qint64 n = QT_WRITE(fd, _data.constData(), qMin<qint64>(left, _data.size()));
+                if (n <= 0) {
+                    _errors++;
+                    break;
+                }
+                left -= n;
+            }
+            _bytes += size;
+        }
+        QT_CLOSE(fd);
+
+        _files++;
+        if (_linkTargets.count() < 1000) {
+            _linkTargets.append(p);
+        } else {
+            _linkTargets[_random.range(_linkTargets.count())] = p;
+        }
+    }
+
+    void generateDir(const QString &path, int depth)
+    {
+        int count = fileCount();
+        for (int i = 0; i < count; i++) {
+            // the index keeps names unique
+            createFile(QStringLiteral("%1/%2%3").arg(path).arg(name()).arg(i));
+        }
+
+        if (depth >= _shape.depth) {
+            return;
+        }
+        for (int i = 0; i < _shape.fanout; i++) {
+            QString d = QStringLiteral("%1/%2%3.d").arg(path).arg(name()).arg(i);
+            if (!QDir().mkdir(d)) {
+                _errors++;
+                continue;
+            }
+            _dirs++;
+            generateDir(d, depth + 1);
+        }
+    }
+
+    TreeShape _shape;
+    Random _random;
+    QByteArray _data;
+    QVector<QByteArray> _linkTargets;
+    qint64 _dirs, _files, _links, _bytes, _errors;
+};
+
+/* Resource usage of the process. The calls of a scan are counted by
+ * ScanStatistics, see scanCalls() */
+struct Usage {
+    Usage()
+    {
+        wall = 0;
+        user = 0;
+        system = 0;
+        contextSwitches = 0;
+        peakRss = 0;
+    }
+
+    static Usage now(const QElapsedTimer &timer)
+    {
+        Usage u;
+        u.wall = timer.nsecsElapsed() / 1000;
+
+        struct rusage ru;
+        if (getrusage(RUSAGE_SELF, &ru) == 0) {
+            u.user = (qint64)ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec;
+            u.system = (qint64)ru.ru_stime.tv_sec * 1000000 + ru.ru_stime.tv_usec;
+            u.contextSwitches = ru.ru_nvcsw + ru.ru_nivcsw;
+            u.peakRss = (qint64)ru.ru_maxrss * 1024;
+        }
+        return u;
+    }
+
+    // microseconds
+    qint64 wall, user, system;
+    qint64 contextSwitches;
+    qint64 peakRss;
+};
+
+static QJsonObject phase(const QString &name, const Usage &from, const Usage &to,
+                         qint64 entries)
+{
+    QJsonObject o;
+    o[QStringLiteral("name")] = name;
+    o[QStringLiteral("wall_us")] = to.wall - from.wall;
+    o[QStringLiteral("user_us")] = to.user - from.user;
+    o[QStringLiteral("system_us")] = to.system - from.system;
+    o[QStringLiteral("context_switches")] = to.contextSwitches - from.contextSwitches;
+    o[QStringLiteral("peak_rss")] = to.peakRss;
+    if (entries > 0) {
+        o[QStringLiteral("entries")] = entries;
+        double secs = (to.wall - from.wall) / 1e6;
+        o[QStringLiteral("entries_per_sec")] = (secs > 0) ? entries / secs : 0.0;
+    }
+    return o;
+}
+
+/* lstat() calls and directory reads of the last scan */
+static void scanCalls(const ScanStatistics &s, QJsonObject &o)
+{
+    qint64 lstats = 0, listings = 0;
+    foreach (DeviceStats *ds, s.devices()) {
+        lstats += ds->statLatency.count();
+        listings += ds->listings;
+    }
+    o[QStringLiteral("lstat_calls")] = lstats;
+    o[QStringLiteral("dir_listings")] = listings;
+}
+
+/* One complete scan of <m>, as FSView does it */
+static qint64 scanTree(ScanManager &m, qint64 &dirsScanned)
+{
+    m.startScan();
+    dirsScanned = 0;
+    while (m.scanLength() > 0) {
+        m.scan(0);
+        dirsScanned++;
+    }
+
+    ScanDir *top = m.top();
+    return (qint64)top->fileCount() + top->dirCount();
+}
+
+/* Lays out a scanned directory with its subdirectories and files
+ * like FSView shows it, returns the number of rectangles */
+static qint64 layoutTree(ScanDir *d, const QRect &r, const TreeMapLayout &l, int depth)
+{
+    QVector<QPair<double, int> > order;
+    ScanDirVector &dirs = d->dirs();
+    ScanFileVector &files = d->files();
+    for (int i = 0; i < dirs.count(); i++) {
+        order.append(qMakePair((double)dirs[i].size(), i));
+    }
+    for (int i = 0; i < files.count(); i++) {
+        order.append(qMakePair((double)files[i].size(), dirs.count() + i));
+    }
+    // biggest first
+    std::sort(order.begin(), order.end(), std::greater<QPair<double, int> >());
+
+    QVector<double> values;
+    values.reserve(order.count());
+    for (int i = 0; i < order.count(); i++) {
+        values.append(order[i].first);
+    }
+
+    QVector<QRect> rects;
+    qint64 count = l.layout(r, values, rects, depth);
+    for (int i = 0; i < order.count(); i++) {
+        int idx = order[i].second;
+        if (idx < dirs.count() && rects[i].isValid()) {
+            // leave a border like TreeMapWidget
+            count += layoutTree(&dirs[idx], rects[i].adjusted(2, 2, -2, -2), l, depth + 1);
+        }
+    }
+    return count;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QStringLiteral("Scan throughput benchmark"));
+    parser.addHelpOption();
+
+    QCommandLineOption rootOption(QStringLiteral("root"), QStringLiteral("Directory to create the tree in (e.g. a tmpfs or loop mount)"), QStringLiteral("dir"));
+    QCommandLineOption seedOption(QStringLiteral("seed"), QStringLiteral("Random seed"), QStringLiteral("n"), QStringLiteral("1"));
+    QCommandLineOption fanoutOption(QStringLiteral("fanout"), QStringLiteral("Subdirectories per directory"), QStringLiteral("n"), QStringLiteral("8"));
+    QCommandLineOption depthOption(QStringLiteral("depth"), QStringLiteral("Depth of the tree"), QStringLiteral("n"), QStringLiteral("4"));
+    QCommandLineOption filesOption(QStringLiteral("files"), QStringLiteral("Mean number of files per directory"), QStringLiteral("n"), QStringLiteral("20"));
+    QCommandLineOption distOption(QStringLiteral("distribution"), QStringLiteral("Files per directory: fixed, uniform or zipf"), QStringLiteral("name"), QStringLiteral("uniform"));
+    QCommandLineOption nameOption(QStringLiteral("name-length"), QStringLiteral("Mean length of names"), QStringLiteral("n"), QStringLiteral("12"));
+    QCommandLineOption sizeOption(QStringLiteral("max-size"), QStringLiteral("Maximal file size in bytes"), QStringLiteral("n"), QStringLiteral("65536"));
+    QCommandLineOption linkOption(QStringLiteral("hard-links"), QStringLiteral("Fraction of files which are hard links"), QStringLiteral("f"), QStringLiteral("0"));
+    QCommandLineOption sparseOption(QStringLiteral("sparse"), QStringLiteral("Fraction of files which are sparse"), QStringLiteral("f"), QStringLiteral("0"));
+    QCommandLineOption noDataOption(QStringLiteral("no-data"), QStringLiteral("Do not write file contents"));
+    QCommandLineOption repeatOption(QStringLiteral("repeat"), QStringLiteral("Number of scans"), QStringLiteral("n"), QStringLiteral("3"));
+    QCommandLineOption keptOption(QStringLiteral("kept-files"), QStringLiteral("Scan aggregate-only, keeping the n largest files per directory"), QStringLiteral("n"), QStringLiteral("-1"));
+    QCommandLineOption keepOption(QStringLiteral("keep"), QStringLiteral("Do not remove the tree afterwards"));
+    QCommandLineOption outputOption(QStringLiteral("output"), QStringLiteral("Write JSON to file instead of stdout"), QStringLiteral("file"));
+    parser.addOption(rootOption);
+    parser.addOption(seedOption);
+    parser.addOption(fanoutOption);
+    parser.addOption(depthOption);
+    parser.addOption(filesOption);
+    parser.addOption(distOption);
+    parser.addOption(nameOption);
+    parser.addOption(sizeOption);
+    parser.addOption(linkOption);
+    parser.addOption(sparseOption);
+    parser.addOption(noDataOption);
+    parser.addOption(repeatOption);
+    parser.addOption(keptOption);
+    parser.addOption(keepOption);
+    parser.addOption(outputOption);
+    parser.process(app);
+
+    TreeShape shape;
+    shape.seed = parser.value(seedOption).toULongLong();
+    shape.fanout = parser.value(fanoutOption).toInt();
+    shape.depth = parser.value(depthOption).toInt();
+    shape.files = parser.value(filesOption).toInt();
+    shape.distribution = parser.value(distOption);
+    shape.nameLength = qMax(1, parser.value(nameOption).toInt());
+    shape.maxFileSize = qMax(1LL, parser.value(sizeOption).toLongLong());
+    shape.hardLinks = parser.value(linkOption).toDouble();
+    shape.sparse = parser.value(sparseOption).toDouble();
+    shape.writeData = !parser.isSet(noDataOption);
+
+    // by default in shared memory, to measure the scan and not the disk
+    QString base = parser.value(rootOption);
+    if (base.isEmpty()) {
+        base = QDir(QStringLiteral("/dev/shm")).exists() ?
+               QStringLiteral("/dev/shm") : QDir::tempPath();
+    }
+    QTemporaryDir dir(base + QStringLiteral("/fsview-scanbench-XXXXXX"));
+    if (!dir.isValid()) {
+        QTextStream(stderr) << "scanbench: can not create directory in " << base << endl;
+        return 1;
+    }
+    dir.setAutoRemove(!parser.isSet(keepOption));
+
+    QElapsedTimer timer;
+    timer.start();
+    QJsonArray phases;
+
+    Usage u0 = Usage::now(timer);
+    TreeGenerator generator(shape);
+    generator.generate(dir.path());
+    Usage u1 = Usage::now(timer);
+    phases.append(phase(QStringLiteral("generate"), u0, u1,
+                        generator.files() + generator.links() + generator.dirs()));
+
+    // the first scan sees a cold dentry cache only on a fresh mount
+    int repeat = qMax(1, parser.value(repeatOption).toInt());
+    ScanManager m(dir.path());
+    m.setKeptFiles(parser.value(keptOption).toInt());
+    for (int i = 0; i < repeat; i++) {
+        qint64 dirsScanned;
+        Usage from = Usage::now(timer);
+        qint64 entries = scanTree(m, dirsScanned);
+        Usage to = Usage::now(timer);
+
+        QJsonObject o = phase(QStringLiteral("scan"), from, to, entries);
+        o[QStringLiteral("run")] = i;
+        o[QStringLiteral("dirs_scanned")] = dirsScanned;
+        scanCalls(m.statistics(), o);
+        o[QStringLiteral("statistics")] = m.statistics().toJson();
+        o[QStringLiteral("tree_memory")] = m.memoryUsage();
+        phases.append(o);
+    }
+
+    // layout of the last scan for a full HD window
+    TreeMapLayout layout;
+    Usage from = Usage::now(timer);
+    qint64 rects = layoutTree(m.top(), QRect(0, 0, 1920, 1080), layout, 1);
+    Usage to = Usage::now(timer);
+    QJsonObject o = phase(QStringLiteral("layout"), from, to, 0);
+    o[QStringLiteral("rects")] = rects;
+    phases.append(o);
+
+    QJsonObject tree;
+    tree[QStringLiteral("seed")] = QString::number(shape.seed);
+    tree[QStringLiteral("fanout")] = shape.fanout;
+    tree[QStringLiteral("depth")] = shape.depth;
+    tree[QStringLiteral("files")] = shape.files;
+    tree[QStringLiteral("distribution")] = shape.distribution;
+    tree[QStringLiteral("name_length")] = shape.nameLength;
+    tree[QStringLiteral("max_size")] = shape.maxFileSize;
+    tree[QStringLiteral("hard_links")] = shape.hardLinks;
+    tree[QStringLiteral("sparse")] = shape.sparse;
+    tree[QStringLiteral("created_dirs")] = generator.dirs();
+    tree[QStringLiteral("created_files")] = generator.files();
+    tree[QStringLiteral("created_links")] = generator.links();
+    tree[QStringLiteral("written_bytes")] = generator.bytes();
+    tree[QStringLiteral("errors")] = generator.errors();
+
+    QJsonObject result;
+    result[QStringLiteral("benchmark")] = QStringLiteral("scan");
+    result[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    result[QStringLiteral("root")] = dir.path();
+    result[QStringLiteral("kept_files")] = m.keptFiles();
+    result[QStringLiteral("tree")] = tree;
+    result[QStringLiteral("phases")] = phases;
+
+    QByteArray json = QJsonDocument(result).toJson();
+    if (parser.isSet(outputOption)) {
+        QFile f(parser.value(outputOption));
+        if (!f.open(QIODevice::WriteOnly) || f.write(json) != json.size()) {
+            QTextStream(stderr) << "scanbench: can not write " << f.fileName() << endl;
+            return 1;
+        }
+    } else {
+        QTextStream(stdout) << json;
+    }
+    return 0;
+}
@@ -0,0 +1,119 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+#include "checkpoint.h"
+
+#include <QDebug>
+
+#define CHECKPOINT_MAGIC 0x46535643 /* "FSVC" */
+#define CHECKPOINT_VERSION 1
+
+// written data is flushed after this many milliseconds
+#define FLUSH_INTERVAL 2000
+
+ScanCheckpoint::ScanCheckpoint()
+{
+    _end = 0;
+}
+
+ScanCheckpoint::~ScanCheckpoint()
+{
+    flush();
+}
+
+bool ScanCheckpoint::create(const QString &file, const QString &top)
+{
+    _file.close();
+    _file.setFileName(file);
+    if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qDebug() << "ScanCheckpoint: can not write " << file;
+        return false;
+    }
+    _stream.setDevice(&_file);
+    _stream << (quint32)CHECKPOINT_MAGIC << (quint32)CHECKPOINT_VERSION << top;
+    _file.flush();
+    _flushTimer.start();
+    return (_stream.status() == QDataStream::Ok);
+}
+
+bool ScanCheckpoint::open(const QString &file, QString &top)
+{
+    _file.close();
+    _file.setFileName(file);
+    if (!_file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+    _stream.setDevice(&_file);
+
+    quint32 magic, version;
+    _stream >> magic >> version;
+    if ((magic != CHECKPOINT_MAGIC) || (version != CHECKPOINT_VERSION)) {
+        qDebug() << "ScanCheckpoint: " << file << " is no checkpoint";
+        return false;
+    }
+    _stream >> top;
+    _end = _file.pos();
+    return (_stream.status() == QDataStream::Ok);
+}
+
+bool ScanCheckpoint::read(Record &r, QString &path, QByteArray &data)
+{
+    if (_stream.atEnd()) {
+        return false;
+    }
+
+    quint8 kind;
+    QByteArray record;
+    _stream >> kind >> path >> record;
+    if (_stream.status() != QDataStream::Ok) {
+        if (0) qDebug() << "ScanCheckpoint: incomplete record at " << _end << endl;
+        return false;
+    }
+    r = (Record)kind;
+    data = record;
+    _end = _file.pos();
+    return true;
+}
+
+bool ScanCheckpoint::startAppend()
+{
+    // cut off what was not read
+    if (!_file.resize(_end) || !_file.seek(_end)) {
+        return false;
+    }
+    _stream.resetStatus();
+    _flushTimer.start();
+    return true;
+}
+
+void ScanCheckpoint::write(Record r, const QString &path, const QByteArray &data)
+{
+    _stream << (quint8)r << path << data;
+
+    if (_flushTimer.elapsed() > FLUSH_INTERVAL) {
+        flush();
+    }
+}
+
+void ScanCheckpoint::flush()
+{
+    if (_file.isOpen()) {
+        _file.flush();
+    }
+    _flushTimer.restart();
+}
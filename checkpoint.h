@@ -0,0 +1,79 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+
+/*
+ * Append-only log of a scan, to continue it after a restart
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+
+/**
+ * A checkpoint file: a header with the top path, then one record
+ * per event of the scan, only ever appended. Records are length
+ * prefixed, so an incomplete last record (after a crash) is detected
+ * and cut off when appending again.
+ *
+ * Directories listed by a record without record of their own are
+ * the ones still to be scanned: the queue is not written separately.
+ * Written data is flushed every few seconds, not per record.
+ */
+class ScanCheckpoint
+{
+public:
+    enum Record {
+        Dir = 0, // contents of a scanned directory
+        Rescan,  // directory cleared for a new scan
+        Top      // new top directory above the old one, with contents
+    };
+
+    ScanCheckpoint();
+    ~ScanCheckpoint();
+
+    // starts a new log for the tree at <top>
+    bool create(const QString &file, const QString &top);
+    // opens an existing log for reading its records
+    bool open(const QString &file, QString &top);
+    // returns false at the end or at an incomplete record
+    bool read(Record &, QString &path, QByteArray &data);
+    // appends after the last complete record read
+    bool startAppend();
+
+    void write(Record, const QString &path,
+               const QByteArray &data = QByteArray());
+    void flush();
+
+    QString fileName() const
+    {
+        return _file.fileName();
+    }
+
+private:
+    QFile _file;
+    QDataStream _stream;
+    qint64 _end;
+    QElapsedTimer _flushTimer;
+};
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,120 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "colortable.h"
+
+#include "mimetypes.h"
+
+ColorTable *ColorTable::self()
+{
+    static ColorTable *s = 0;
+    if (!s) {
+        s = new ColorTable;
+    }
+    return s;
+}
+
+ColorTable::ColorTable()
+{
+    // hue steps of 100 degrees repeat after 18 levels
+    for (int d = 0; d < 18; d++) {
+        _depthColors[d] = QColor::fromHsv((100 * d) % 360, 192, 128);
+    }
+
+    // from green (shrinking) over grey to red (growing)
+    for (int i = -GROWTH_STEPS; i <= GROWTH_STEPS; i++) {
+        int s = 255 * (i < 0 ? -i : i) / GROWTH_STEPS;
+        _growthColors[i + GROWTH_STEPS] = QColor::fromHsv(i < 0 ? 120 : 0, s, 224);
+    }
+}
+
+/* Hue and saturation derived from the name; the hue is in the
+ * upper bits, the saturation (< 192) in the lower 8 bits */
+int ColorTable::nameKey(const QString &n)
+{
+    QByteArray tmpBuf = n.toLocal8Bit();
+    const char *str = tmpBuf.data();
+    int h = 0, s = 100;
+    while (*str) {
+        h = (h * 37 + s * (unsigned) * str) % 256;
+        s = (s * 17 + h * (unsigned) * str) % 192;
+        str++;
+    }
+    return (h << 8) | s;
+}
+
+QColor ColorTable::depthColor(int depth) const
+{
+    return _depthColors[depth % 18];
+}
+
+QColor ColorTable::nameColor(int key) const
+{
+    return QColor::fromHsv(key >> 8, 64 + (key & 0xff), 192);
+}
+
+/* Doubling (or shrinking to nothing) gets the strongest color */
+QColor ColorTable::growthColor(double rate) const
+{
+    int i = (int)(rate * GROWTH_STEPS + (rate < 0 ? -.5 : .5));
+    if (i > GROWTH_STEPS) {
+        i = GROWTH_STEPS;
+    } else if (i < -GROWTH_STEPS) {
+        i = -GROWTH_STEPS;
+    }
+    return _growthColors[i + GROWTH_STEPS];
+}
+
+QColor ColorTable::reclaimColor(double fraction) const
+{
+    if (fraction <= 0.0) {
+        return QColor();
+    }
+    return growthColor(fraction);
+}
+
+QColor ColorTable::idColor(uint id)
+{
+    if (id == 0) {
+        return QColor();
+    }
+
+    QHash<uint, QColor>::const_iterator it = _idColors.constFind(id);
+    if (it != _idColors.constEnd()) {
+        return *it;
+    }
+
+    QColor c = nameColor(nameKey(QString::number(id)));
+    _idColors.insert(id, c);
+    return c;
+}
+
+QColor ColorTable::typeColor(int typeId)
+{
+    if (typeId == MimeTypes::Unknown) {
+        return QColor();
+    }
+
+    if (typeId >= _typeColors.count()) {
+        // ids are given out in order: fill up to the new one
+        MimeTypes *types = MimeTypes::self();
+        for (int i = _typeColors.count(); i <= typeId; i++) {
+            _typeColors.append(nameColor(nameKey(types->mimeType(i).comment())));
+        }
+    }
+    return _typeColors[typeId];
+}
@@ -0,0 +1,69 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Colors for the FSView color modes
+ */
+
+#ifndef COLORTABLE_H
+#define COLORTABLE_H
+
+#include <QColor>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+// color steps for growing (and shrinking) directories
+#define GROWTH_STEPS 10
+
+/**
+ * Process-wide table of the colors used by the FSView color modes.
+ *
+ * Items only keep small keys (name key, uid, gid, MIME type id,
+ * depth); a color is a lookup in this table, without any string
+ * work while painting. Like MimeTypes, only to be used from the GUI
+ * thread.
+ * An invalid color means "no color", i.e. the default background.
+ */
+class ColorTable
+{
+public:
+    static ColorTable *self();
+
+    // key for a name, to be computed once per item
+    static int nameKey(const QString &);
+
+    QColor depthColor(int depth) const;
+    QColor nameColor(int key) const;
+    // for uids and gids; 0 (root) gets no color
+    QColor idColor(uint id);
+    QColor typeColor(int typeId);
+    // relative growth: red for growing, green for shrinking
+    QColor growthColor(double rate) const;
+    // reclaimable part of an item's size, from grey to red
+    QColor reclaimColor(double fraction) const;
+
+private:
+    ColorTable();
+
+    QColor _depthColors[18];
+    QColor _growthColors[2 * GROWTH_STEPS + 1];
+    QHash<uint, QColor> _idColors;
+    QVector<QColor> _typeColors;
+};
+
+#endif // COLORTABLE_H
@@ -0,0 +1,167 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "diffview.h"
+
+#include <QDebug>
+
+#include "inode.h"
+#include "snapshot.h"
+
+/* Text for a size change */
+static QString deltaString(qint64 oldSize, qint64 newSize)
+{
+    qint64 d = newSize - oldSize;
+    return QString(d < 0 ? QLatin1Char('-') : QLatin1Char('+')) +
+           Inode::sizeString((double)(d < 0 ? -d : d));
+}
+
+static QColor changeColor(DiffListener::Change c)
+{
+    switch (c) {
+    case DiffListener::Added:   return QColor::fromHsv(0, 224, 224);
+    case DiffListener::Grown:   return QColor::fromHsv(0, 96, 240);
+    case DiffListener::Shrunk:  return QColor::fromHsv(120, 96, 240);
+    case DiffListener::Removed: return QColor::fromHsv(120, 224, 224);
+    }
+    return QColor();
+}
+
+static QString changeString(DiffListener::Change c)
+{
+    switch (c) {
+    case DiffListener::Added:   return DiffView::tr("added");
+    case DiffListener::Grown:   return DiffView::tr("grown");
+    case DiffListener::Shrunk:  return DiffView::tr("shrunk");
+    case DiffListener::Removed: return DiffView::tr("removed");
+    }
+    return QString();
+}
+
+/* Builds items for the changes below a root item.
+ * Directories are only kept if something changed inside. */
+class DiffItemBuilder: public DiffListener
+{
+public:
+    explicit DiffItemBuilder(TreeMapItem *root)
+    {
+        _root = root;
+    }
+    ~DiffItemBuilder()
+    {
+        // directories left open by a failed diff
+        foreach (TreeMapItem *i, _stack)
+            if (i != _root) {
+                delete i;
+            }
+    }
+
+    void enterDir(const QString &name) Q_DECL_OVERRIDE
+    {
+        // the top directory is the root item
+        TreeMapItem *i = _root;
+        if (!_stack.isEmpty()) {
+            // only added to the parent if something changed below
+            i = new TreeMapItem(0, 0, name);
+            i->setParent(_stack.last());
+        }
+        i->setSorting(-1);
+        _stack.append(i);
+        _sums.append(0.0);
+    }
+
+    void leaveDir(qint64 oldSize, qint64 newSize) Q_DECL_OVERRIDE
+    {
+        TreeMapItem *i = _stack.takeLast();
+        double sum = _sums.takeLast();
+
+        i->setSorting(-2, false);
+        i->setValue(sum);
+        i->setText(1, deltaString(oldSize, newSize));
+        i->setBackColor(changeColor((newSize < oldSize) ? Shrunk : Grown));
+        if (i == _root) {
+            return;
+        }
+
+        if (sum == 0) {
+            // nothing changed below
+            delete i;
+            return;
+        }
+        _stack.last()->addItem(i);
+        _sums.last() += sum;
+    }
+
+    void changed(const QString &name, bool isDir, Change c,
+                 qint64 oldSize, qint64 newSize) Q_DECL_OVERRIDE
+    {
+        double v = (double)((newSize > oldSize) ? newSize - oldSize : oldSize - newSize);
+        if (v == 0) {
+            // e.g. an empty file was added
+            v = 1;
+        }
+
+        TreeMapItem *i = new TreeMapItem(0, v, name,
+                                         deltaString(oldSize, newSize),
+                                         changeString(c));
+        i->setBackColor(changeColor(c));
+        if (isDir) {
+            i->setText(3, DiffView::tr("directory"));
+        }
+        _stack.last()->addItem(i);
+        _sums.last() += v;
+    }
+
+private:
+    TreeMapItem *_root;
+    QList<TreeMapItem *> _stack;
+    QList<double> _sums;
+};
+
+
+DiffView::DiffView(QWidget *parent)
+    : TreeMapWidget(new TreeMapItem(), parent)
+{
+    setFieldType(0, tr("Name"));
+    setFieldType(1, tr("Change"));
+    setFieldType(2, tr("Kind"));
+    setFieldType(3, tr("Type"));
+
+    setVisibleWidth(4, true);
+    setSplitMode(TreeMapItem::Rows);
+    setFieldForced(0, true); // show directory names
+    setFieldForced(1, true); // show size changes
+}
+
+bool DiffView::compare(DiffSource *oldTree, DiffSource *newTree)
+{
+    TreeMapItem *b = base();
+    b->clear();
+    b->setText(0, newTree->topPath());
+
+    DiffItemBuilder builder(b);
+    ScanDiff diff(oldTree, newTree);
+    bool ok = diff.run(&builder);
+    if (!ok) {
+        qDebug() << "DiffView: comparing " << oldTree->topPath()
+                 << " with " << newTree->topPath() << " failed";
+    }
+
+    setWindowTitle(tr("Changes in %1 - FSView").arg(newTree->topPath()));
+    redraw();
+    return ok;
+}
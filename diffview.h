@@ -0,0 +1,48 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * TreeMap of the difference of two scans
+ */
+
+#ifndef DIFFVIEW_H
+#define DIFFVIEW_H
+
+#include "treemap.h"
+
+class DiffSource;
+
+/**
+ * Shows the changes between two trees.
+ *
+ * Only changed files and directories get items. Areas are
+ * proportional to the absolute size change; growing entries are
+ * red, shrinking ones green, with stronger colors for added and
+ * removed entries.
+ */
+class DiffView : public TreeMapWidget
+{
+    Q_OBJECT
+
+public:
+    explicit DiffView(QWidget *parent = Q_NULLPTR);
+
+    // returns false if one of the trees could not be read
+    bool compare(DiffSource *oldTree, DiffSource *newTree);
+};
+
+#endif // DIFFVIEW_H
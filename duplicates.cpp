@@ -0,0 +1,469 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "duplicates.h"
+
+#include <QFile>
+#include <QHash>
+#include <QMutexLocker>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QtEndian>
+#include <QDebug>
+#include <qplatformdefs.h>
+
+#include <fcntl.h>
+#include <string.h>
+
+#include "scan.h"
+
+// bytes hashed at start and end of a file in the first pass
+#define PARTIAL_SIZE 4096
+// read size for full hashes
+#define CHUNK_SIZE (256*1024)
+// files below this allocated size are not worth the effort
+#define MIN_FILE_SIZE 4096
+#define DEFAULT_READERS 4
+
+// XXHash64
+
+static const quint64 Prime1 = 11400714785074694791ULL;
+static const quint64 Prime2 = 14029467366897019727ULL;
+static const quint64 Prime3 = 1609587929392839161ULL;
+static const quint64 Prime4 = 9650029242287828579ULL;
+static const quint64 Prime5 = 2870177450012600261ULL;
+
+static inline quint64 rotl(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline quint64 round64(quint64 acc, quint64 input)
+{
+    acc += input * Prime2;
+    return rotl(acc, 31) * Prime1;
+}
+
+static inline quint64 merge64(quint64 acc, quint64 v)
+{
+    acc ^= round64(0, v);
+    return acc * Prime1 + Prime4;
+}
+
+static inline quint64 read64(const uchar *p)
+{
+    return qFromLittleEndian<quint64>(p);
+}
+
+static inline quint32 read32(const uchar *p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+XXHash64::XXHash64(quint64 seed)
+{
+    _seed = seed;
+    _v[0] = seed + Prime1 + Prime2;
+    _v[1] = seed + Prime2;
+    _v[2] = seed;
+    _v[3] = seed - Prime1;
+    _bufLen = 0;
+    _total = 0;
+}
+
+// the four lanes are independent, so the compiler can vectorize
+void XXHash64::block(const uchar *p)
+{
+    _v[0] = round64(_v[0], read64(p));
+    _v[1] = round64(_v[1], read64(p + 8));
+    _v[2] = round64(_v[2], read64(p + 16));
+    _v[3] = round64(_v[3], read64(p + 24));
+}
+
+void XXHash64::add(const char *data, qint64 len)
+{
+    const uchar *p = (const uchar *)data;
+    _total += len;
+
+    if (_bufLen + len < 32) {
+        memcpy(_buf + _bufLen, p, len);
+        _bufLen += len;
+        return;
+    }
+    if (_bufLen > 0) {
+        int fill = 32 - _bufLen;
+        memcpy(_buf + _bufLen, p, fill);
+        block(_buf);
+        p += fill;
+        len -= fill;
+        _bufLen = 0;
+    }
+    while (len >= 32) {
+        block(p);
+        p += 32;
+        len -= 32;
+    }
+    memcpy(_buf, p, len);
+    _bufLen = len;
+}
+
+quint64 XXHash64::result() const
+{
+    quint64 h;
+
+    if (_total >= 32) {
+        h = rotl(_v[0], 1) + rotl(_v[1], 7) + rotl(_v[2], 12) + rotl(_v[3], 18);
+        for (int i = 0; i < 4; i++) {
+            h = merge64(h, _v[i]);
+        }
+    } else {
+        h = _seed + Prime5;
+    }
+    h += _total;
+
+    const uchar *p = _buf, *end = _buf + _bufLen;
+    while (p + 8 <= end) {
+        h ^= round64(0, read64(p));
+        h = rotl(h, 27) * Prime1 + Prime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (quint64)read32(p) * Prime1;
+        h = rotl(h, 23) * Prime2 + Prime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * Prime5;
+        h = rotl(h, 11) * Prime1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= Prime2;
+    h ^= h >> 29;
+    h *= Prime3;
+    h ^= h >> 32;
+    return h;
+}
+
+// HashTask: reads one file in the thread pool
+
+class HashTask : public QRunnable
+{
+public:
+    HashTask(DuplicateFinder *f, DuplicateFinder::Candidate *c, bool full)
+    {
+        _finder = f;
+        _candidate = c;
+        _full = full;
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (_full) {
+            _finder->fullHash(_candidate);
+        } else {
+            _finder->partialHash(_candidate);
+        }
+    }
+
+private:
+    DuplicateFinder *_finder;
+    DuplicateFinder::Candidate *_candidate;
+    bool _full;
+};
+
+// DuplicateFinder
+
+DuplicateFinder::DuplicateFinder(QObject *parent)
+    : QThread(parent)
+{
+    _budget = 0;
+    _bytesRead = 0;
+    _readers = DEFAULT_READERS;
+    _complete = true;
+}
+
+static void addCandidates(ScanDir *d, QHash<qint64, QVector<QPair<ScanDir *, int> > > &bySize)
+{
+    ScanFileVector &files = d->files();
+    for (int i = 0; i < files.count(); i++) {
+        if (files[i].size() < MIN_FILE_SIZE) {
+            continue;
+        }
+        bySize[files[i].size()].append(qMakePair(d, i));
+    }
+
+    ScanDirVector &dirs = d->dirs();
+    for (int i = 0; i < dirs.count(); i++) {
+        addCandidates(&dirs[i], bySize);
+    }
+}
+
+void DuplicateFinder::setTop(ScanDir *top)
+{
+    _candidates.clear();
+    _sizeGroups.clear();
+    _inodes.clear();
+    _reclaimable.clear();
+    _reclaimableDirs.clear();
+    _bytesRead = 0;
+    _complete = true;
+    if (!top) {
+        return;
+    }
+
+    // files of equal content have equal allocated size
+    QHash<qint64, QVector<QPair<ScanDir *, int> > > bySize;
+    addCandidates(top, bySize);
+
+    QHash<ScanDir *, QString> dirPaths;
+    QHash<qint64, QVector<QPair<ScanDir *, int> > >::const_iterator it;
+    for (it = bySize.constBegin(); it != bySize.constEnd(); ++it) {
+        if (it.value().count() < 2) {
+            continue;
+        }
+
+        QVector<int> group;
+        foreach (const QPair<ScanDir *, int> &f, it.value()) {
+            ScanDir *d = f.first;
+            if (!dirPaths.contains(d)) {
+                dirPaths.insert(d, d->path());
+            }
+
+            Candidate c;
+            c.file = &d->files()[f.second];
+            c.dir = d;
+            c.path = dirPaths[d] + '/' + c.file->name();
+            c.length = 0;
+            c.hash = 0;
+            c.ok = false;
+            group.append(_candidates.count());
+            _candidates.append(c);
+        }
+        _sizeGroups.append(group);
+    }
+
+    if (0) qDebug() << "DuplicateFinder: " << _candidates.count()
+                    << " candidates in " << _sizeGroups.count() << " groups" << endl;
+}
+
+bool DuplicateFinder::takeBudget(qint64 bytes)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (_budget > 0 && _bytesRead + bytes > _budget) {
+        _complete = false;
+        return false;
+    }
+    _bytesRead += bytes;
+    return true;
+}
+
+bool DuplicateFinder::firstLink(quint64 dev, quint64 ino)
+{
+    QMutexLocker locker(&_mutex);
+
+    QPair<quint64, quint64> key(dev, ino);
+    if (_inodes.contains(key)) {
+        return false;
+    }
+    _inodes.insert(key);
+    return true;
+}
+
+/* Hashes length, head and tail of a file.
+ * The length is part of the hash as the groups are built by
+ * allocated size only. */
+bool DuplicateFinder::partialHash(Candidate *c)
+{
+    c->ok = false;
+
+    // tasks still queued after a stop
+    if (isInterruptionRequested()) {
+        return false;
+    }
+
+    int fd = QT_OPEN(QFile::encodeName(c->path).constData(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    QT_STATBUF buff;
+    if (QT_FSTAT(fd, &buff) != 0 ||
+        !firstLink(buff.st_dev, buff.st_ino)) {
+        QT_CLOSE(fd);
+        return false;
+    }
+    c->length = buff.st_size;
+
+    qint64 toRead = qMin<qint64>(c->length, 2 * PARTIAL_SIZE);
+    if (!takeBudget(toRead)) {
+        QT_CLOSE(fd);
+        return false;
+    }
+
+#ifdef POSIX_FADV_RANDOM
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+
+    char buf[PARTIAL_SIZE];
+    XXHash64 h(c->length);
+    qint64 n = QT_READ(fd, buf, PARTIAL_SIZE);
+    if (n > 0) {
+        h.add(buf, n);
+    }
+    if (c->length > PARTIAL_SIZE) {
+        qint64 tail = qMax<qint64>(PARTIAL_SIZE, c->length - PARTIAL_SIZE);
+        n = -1;
+        if (QT_LSEEK(fd, tail, SEEK_SET) == tail) {
+            n = QT_READ(fd, buf, PARTIAL_SIZE);
+        }
+        if (n > 0) {
+            h.add(buf, n);
+        }
+    }
+    QT_CLOSE(fd);
+
+    c->hash = h.result();
+    c->ok = (n >= 0);
+    return c->ok;
+}
+
+bool DuplicateFinder::fullHash(Candidate *c)
+{
+    c->ok = false;
+
+    if (isInterruptionRequested() || !takeBudget(c->length)) {
+        return false;
+    }
+
+    int fd = QT_OPEN(QFile::encodeName(c->path).constData(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    posix_fadvise(fd, 0, CHUNK_SIZE * 4, POSIX_FADV_WILLNEED);
+#endif
+
+    QByteArray buf(CHUNK_SIZE, 0);
+    XXHash64 h(c->length);
+    qint64 n, total = 0;
+    while ((n = QT_READ(fd, buf.data(), CHUNK_SIZE)) > 0) {
+        if (isInterruptionRequested()) {
+            n = -1;
+            break;
+        }
+        h.add(buf.constData(), n);
+        total += n;
+    }
+
+#ifdef POSIX_FADV_DONTNEED
+    // do not push other data out of the page cache
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    QT_CLOSE(fd);
+
+    c->hash = h.result();
+    c->ok = (n == 0 && total == c->length);
+    return c->ok;
+}
+
+void DuplicateFinder::hashAll(const QVector<int> &files, bool full)
+{
+    // readers must not detach the shared vector
+    Candidate *candidates = _candidates.data();
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(qMax(1, _readers));
+
+    foreach (int f, files) {
+        if (isInterruptionRequested()) {
+            break;
+        }
+        pool.start(new HashTask(this, candidates + f, full));
+    }
+    pool.waitForDone();
+}
+
+/* Splits groups by hash, dropping files which could not be read
+ * and groups with only one file left. */
+QVector<QVector<int> > DuplicateFinder::split(const QVector<QVector<int> > &groups)
+{
+    QVector<QVector<int> > result;
+
+    foreach (const QVector<int> &g, groups) {
+        QHash<QPair<qint64, quint64>, QVector<int> > byHash;
+        foreach (int f, g) {
+            const Candidate &c = _candidates[f];
+            if (c.ok) {
+                byHash[qMakePair(c.length, c.hash)].append(f);
+            }
+        }
+        foreach (const QVector<int> &h, byHash) {
+            if (h.count() > 1) {
+                result.append(h);
+            }
+        }
+    }
+    return result;
+}
+
+void DuplicateFinder::run()
+{
+    QVector<int> files;
+    foreach (const QVector<int> &g, _sizeGroups) {
+        files += g;
+    }
+    hashAll(files, false);
+    if (isInterruptionRequested()) {
+        return;
+    }
+    QVector<QVector<int> > groups = split(_sizeGroups);
+
+    files.clear();
+    foreach (const QVector<int> &g, groups) {
+        files += g;
+    }
+    hashAll(files, true);
+    if (isInterruptionRequested()) {
+        return;
+    }
+    groups = split(groups);
+
+    foreach (const QVector<int> &g, groups) {
+        for (int i = 1; i < g.count(); i++) {
+            _reclaimable.append(_candidates[g[i]].file);
+            _reclaimableDirs.append(_candidates[g[i]].dir);
+        }
+    }
+
+    if (0) qDebug() << "DuplicateFinder: " << groups.count() << " groups, "
+                    << reclaimableSize() << " bytes reclaimable, "
+                    << _bytesRead << " bytes read" << endl;
+}
+
+qint64 DuplicateFinder::reclaimableSize() const
+{
+    qint64 s = 0;
+    foreach (ScanFile *f, _reclaimable) {
+        s += f->size();
+    }
+    return s;
+}
@@ -0,0 +1,147 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Search for files with the same content
+ */
+
+#ifndef DUPLICATES_H
+#define DUPLICATES_H
+
+#include <QMutex>
+#include <QPair>
+#include <QSet>
+#include <QString>
+#include <QThread>
+#include <QVector>
+
+class ScanDir;
+class ScanFile;
+
+/* 64 bit xxHash, can be fed in pieces */
+class XXHash64
+{
+public:
+    explicit XXHash64(quint64 seed = 0);
+
+    void add(const char *data, qint64 len);
+    quint64 result() const;
+
+private:
+    void block(const uchar *);
+
+    quint64 _v[4];
+    uchar _buf[32];
+    int _bufLen;
+    quint64 _total, _seed;
+};
+
+/**
+ * Finds files with the same content in a finished scan.
+ *
+ * Files are grouped by size first. Of groups with more than one
+ * file, the first and last 4 KiB are hashed; only files still
+ * sharing a hash are fully hashed. Files are read by a pool of
+ * threads, with read-ahead hints, and the total amount of data
+ * read is limited by the read budget. Duplicates not verified
+ * within the budget are not reported. Hard links to a file already
+ * seen are skipped: they take no space of their own.
+ *
+ * setTop() has to be called from the thread owning the scan tree,
+ * which must not change until the search is finished.
+ */
+class DuplicateFinder : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit DuplicateFinder(QObject *parent = Q_NULLPTR);
+
+    // collects the candidates; call before start()
+    void setTop(ScanDir *);
+
+    // maximal bytes to read, 0 for no limit
+    void setReadBudget(qint64 bytes)
+    {
+        _budget = bytes;
+    }
+    void setReaderCount(int n)
+    {
+        _readers = n;
+    }
+
+    /* Results, valid after the thread finished.
+     * For every group of equal files, all but the first one are
+     * reclaimable. */
+    const QVector<ScanFile *> &reclaimableFiles() const
+    {
+        return _reclaimable;
+    }
+    // directories of the reclaimable files, in the same order
+    const QVector<ScanDir *> &reclaimableDirs() const
+    {
+        return _reclaimableDirs;
+    }
+    qint64 reclaimableSize() const;
+    // false if the read budget stopped the search
+    bool complete() const
+    {
+        return _complete;
+    }
+    qint64 bytesRead() const
+    {
+        return _bytesRead;
+    }
+
+    // a file of a size group
+    struct Candidate {
+        QString path;
+        ScanFile *file;
+        ScanDir *dir;
+        qint64 length;
+        quint64 hash;
+        bool ok;
+    };
+
+    // used by the readers
+    bool takeBudget(qint64 bytes);
+    // false for further links to inode <ino> of device <dev>
+    bool firstLink(quint64 dev, quint64 ino);
+    bool partialHash(Candidate *c);
+    bool fullHash(Candidate *c);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    void hashAll(const QVector<int> &files, bool full);
+    QVector<QVector<int> > split(const QVector<QVector<int> > &groups);
+
+    QVector<Candidate> _candidates;
+    QVector<QVector<int> > _sizeGroups;
+
+    QMutex _mutex;
+    QSet<QPair<quint64, quint64> > _inodes;
+    qint64 _budget, _bytesRead;
+    int _readers;
+    bool _complete;
+
+    QVector<ScanFile *> _reclaimable;
+    QVector<ScanDir *> _reclaimableDirs;
+};
+
+#endif // DUPLICATES_H
@@ -25,8 +25,27 @@
 #include <QDir>
 #include <QTimer>
 #include <QApplication>
+#include <QFileDialog>
+#include <QPainter>
 #include <QDebug>
 
+#include "snapshot.h"
+#include "diffview.h"
+#include "duplicates.h"
+#include "profiler.h"
+#include "scanstatsview.h"
+
+#include <unistd.h>
+
+// bytes read by a duplicate search, by default
+#define DUPLICATE_READ_BUDGET (4096LL * 1024 * 1024)
+
+// part of the physical memory used for scan tree and items, by default
+#define MEMORY_BUDGET_DIVISOR 4
+
+// milliseconds between checks for resume of a paused scan
+#define PAUSE_POLL_INTERVAL 200
+
 // FSView
 
 QMap<QString, MetricEntry> FSView::_dirMetric;
@@ -42,6 +61,7 @@ FSView::FSView(Inode *base, QWidget *parent)
     setFieldType(5, tr("Owner"));
     setFieldType(6, tr("Group"));
     setFieldType(7, tr("Mime Type"));
+    setFieldType(8, tr("Reclaimable"));
 
     // defaults
     setVisibleWidth(4, true);
@@ -49,8 +69,21 @@ FSView::FSView(Inode *base, QWidget *parent)
     setFieldForced(0, true); // show directory names
     setFieldForced(1, true); // show directory sizes
     setSelectionMode(TreeMapWidget::Extended);
+    setProgressiveDrawing(true);
 
     _colorMode = Depth;
+    _growthDays = 7;
+    _scanStopped = false;
+    _duplicateFinder = 0;
+    _duplicateBudget = DUPLICATE_READ_BUDGET;
+    _showStats = false;
+    _paused = false;
+    _restored = false;
+    _reprioritize = false;
+    _scanStatsView = 0;
+    _statsEnabledProfiler = false;
+    _aggregate = true;
+    _aggregatedArea = 0;
     _pathDepth = 0;
     _allowRefresh = true;
 
@@ -67,17 +100,45 @@ FSView::FSView(Inode *base, QWidget *parent)
     _lastDir = 0;
 
     _sm.setListener(this);
+    connect(this, SIGNAL(layoutFinished()), this, SLOT(reprioritizeLater()));
+
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    setMemoryBudget((pages > 0 && pageSize > 0) ?
+                    (qint64)pages * pageSize / MEMORY_BUDGET_DIVISOR : 0);
 }
 
 FSView::~FSView()
 {
+    stopDuplicates();
 }
 
 void FSView::stop()
 {
+    if (_sm.scanRunning()) {
+        _scanStopped = true;
+    }
+    _paused = false;
     _sm.stopScan();
 }
 
+void FSView::setPaused(bool paused)
+{
+    _paused = paused;
+    if (paused) {
+        // all scanned so far survives while paused
+        _sm.flushCheckpoint();
+    }
+}
+
+void FSView::setCheckpointFile(const QString &file)
+{
+    _checkpointFile = file;
+    if (_sm.top() && !_sm.setCheckpoint(file)) {
+        qDebug() << "FSView: can not write checkpoint " << file;
+    }
+}
+
 void FSView::setPath(const QString &p)
 {
     Inode *b = (Inode *)base();
@@ -87,8 +148,7 @@ void FSView::setPath(const QString &p)
 
     //qDebug() << "FSView::setPath " << p;
 
-    // stop any previous updating
-    stop();
+    stopDuplicates();
 
     QFileInfo fi(p);
     _path = fi.absoluteFilePath();
@@ -98,11 +158,68 @@ void FSView::setPath(const QString &p)
     _path = QDir::cleanPath(_path);
     _pathDepth = _path.count('/');
 
-    ScanDir *d = _sm.setTop(_path);
-
-    b->setPeer(d);
+    // first frame after navigation should only show top levels
+    restartProgressiveDrawing();
 
+    _aggregatedArea = width() * height();
     setWindowTitle(QStringLiteral("%1 - FSView").arg(_path));
+
+    // zooming in keeps the scan data and a running scan.
+    // Progress stays measured against the running scan, which also
+    // continues outside of the new root.
+    ScanDir *d = _sm.find(_path);
+    if (d) {
+        d->loadFiles();
+        b->setPeer(d);
+        if (!d->scanFinished() && !_sm.scanRunning()) {
+            // not reached or left unfinished by a stopped scan
+            requestUpdate(b);
+        } else {
+            redraw();
+        }
+        return;
+    }
+
+    // going up only scans the new siblings
+    bool running = _sm.scanRunning();
+    if (!running) {
+        newProgressChunk();
+    }
+    d = _sm.extendTop(_path, _chunkData1);
+    if (d) {
+        b->setPeer(d);
+        if (!running) {
+            startUpdates();
+        }
+        return;
+    }
+
+    // stop any previous updating
+    stop();
+
+    // continue a scan of a previous run. A log of another tree is
+    // only replaced if written by us.
+    bool ownLog = _sm.checkpointing();
+    bool otherTree = false;
+    if (!_checkpointFile.isEmpty()) {
+        newProgressChunk();
+        if (_sm.restore(_checkpointFile, _path, _chunkData1, &otherTree)) {
+            _restored = true;
+            // the restored tree can start above
+            b->setPeer(_sm.find(_path));
+            startUpdates();
+            return;
+        }
+    }
+
+    d = _sm.setTop(_path);
+    if (otherTree && !ownLog) {
+        qDebug() << "FSView: checkpoint " << _checkpointFile
+                 << " is for another directory, not overwritten";
+    } else if (!_checkpointFile.isEmpty()) {
+        _sm.setCheckpoint(_checkpointFile);
+    }
+    b->setPeer(d);
     requestUpdate(b);
 }
 
@@ -159,33 +276,48 @@ void FSView::requestUpdate(Inode *i)
         return;
     }
 
+    stopDuplicates();
     peer->clear();
     i->clear();
+    if (peer == _sm.top()) {
+        _restored = false;
+    }
 
     if (!_sm.scanRunning()) {
-        QTimer::singleShot(0, this, SLOT(doUpdate()));
-        QTimer::singleShot(100, this, SLOT(doRedraw()));
-
-        /* start new progress chunk */
-        _progressPhase = 1;
-        _chunkData1 += 3;
-        _chunkData2 = _chunkData1 + 1;
-        _chunkData3 = _chunkData1 + 2;
-        _chunkSize1 = 0;
-        _chunkSize2 = 0;
-        _chunkSize3 = 0;
+        newProgressChunk();
         peer->setData(_chunkData1);
-
-        _progressSize = 0;
-        _progress = 0;
-        _dirsFinished = 0;
-        _lastDir = 0;
-        emit started();
+        startUpdates();
     }
 
     _sm.startScan(peer);
 }
 
+void FSView::newProgressChunk()
+{
+    /* start new progress chunk */
+    _progressPhase = 1;
+    _chunkData1 += 3;
+    _chunkData2 = _chunkData1 + 1;
+    _chunkData3 = _chunkData1 + 2;
+    _chunkSize1 = 0;
+    _chunkSize2 = 0;
+    _chunkSize3 = 0;
+
+    _progressSize = 0;
+    _progress = 0;
+    _dirsFinished = 0;
+    _lastDir = 0;
+}
+
+void FSView::startUpdates()
+{
+    _scanStopped = false;
+    _paused = false;
+    QTimer::singleShot(0, this, SLOT(doUpdate()));
+    QTimer::singleShot(100, this, SLOT(doRedraw()));
+    emit started();
+}
+
 void FSView::scanFinished(ScanDir *d)
 {
     /* if finished directory was from last progress chunk, increment */
@@ -235,7 +367,56 @@ void FSView::scanFinished(ScanDir *d)
 
 void FSView::selected(TreeMapItem *i)
 {
-    setPath(((Inode *)i)->path());
+    // for small files, path() is the directory containing them:
+    // nothing to zoom into if that is shown already
+    Inode *inode = (Inode *)i;
+    if (inode->isGroup() && (inode->parent() == base())) {
+        return;
+    }
+    setPath(inode->path());
+}
+
+void FSView::setAggregateSmallFiles(bool enable)
+{
+    if (_aggregate == enable) {
+        return;
+    }
+
+    _aggregate = enable;
+
+    Inode *b = (Inode *)base();
+    if (b && b->dirPeer()) {
+        // recreate items from the scan data
+        _aggregatedArea = width() * height();
+        b->setPeer(b->dirPeer());
+        redraw();
+    }
+}
+
+double FSView::aggregationArea() const
+{
+    if (!_aggregate) {
+        return 0.0;
+    }
+
+    double area = visibleWidth() * visibleWidth();
+    if (minimalArea() > area) {
+        area = minimalArea();
+    }
+    return area;
+}
+
+void FSView::resizeEvent(QResizeEvent *e)
+{
+    TreeMapWidget::resizeEvent(e);
+
+    // files aggregated for a smaller widget may be visible now
+    Inode *b = (Inode *)base();
+    if (_aggregate && b && b->dirPeer() &&
+        (width() * height() > 2 * _aggregatedArea)) {
+        _aggregatedArea = width() * height();
+        b->setPeer(b->dirPeer());
+    }
 }
 
 void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
@@ -255,6 +436,8 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
     popup.addSeparator();
     QAction *actionStopRefresh = popup.addAction(tr("Stop Refresh"));
     actionStopRefresh->setEnabled(_sm.scanRunning());
+    QAction *actionPause = popup.addAction(_paused ? tr("Resume Scan") : tr("Pause Scan"));
+    actionPause->setEnabled(_sm.scanRunning());
     QAction *actionRefresh = popup.addAction(tr("Refresh"));
     actionRefresh->setEnabled(!_sm.scanRunning());
 
@@ -263,6 +446,21 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
         actionRefreshSelected = popup.addAction(tr("Refresh '%1'").arg(i->text(0)));
     }
     popup.addSeparator();
+    // snapshots need a complete scan with all files kept: others
+    // would show up as deleted, or be missed as duplicates
+    QAction *actionSaveSnapshot = popup.addAction(tr("Save Snapshot..."));
+    actionSaveSnapshot->setEnabled(_sm.top() && !_sm.scanRunning() &&
+                                   allFilesKept());
+    QAction *actionCompare = popup.addAction(tr("Compare with Snapshot..."));
+    actionCompare->setEnabled(_sm.top() && !_sm.scanRunning() &&
+                              allFilesKept());
+    QAction *actionDuplicates = popup.addAction(tr("Find Duplicates"));
+    actionDuplicates->setEnabled(_sm.top() && !_sm.scanRunning() &&
+                                 !findingDuplicates() && allFilesKept());
+    QAction *actionScanStats = popup.addAction(tr("Scan Statistics..."));
+    QAction *actionTrace = popup.addAction(tr("Save Profile Trace..."));
+    actionTrace->setEnabled(Profiler::isEnabled());
+    popup.addSeparator();
     addDepthStopItems(dpopup, 1001, i);
     popup.addMenu(dpopup);
     addAreaStopItems(apopup, 1101, i);
@@ -293,6 +491,8 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
         }
     } else if (action == actionStopRefresh) {
         stop();
+    } else if (action == actionPause) {
+        setPaused(!_paused);
     } else if (action == actionRefreshSelected) {
         //((Inode*)i)->refresh();
         requestUpdate((Inode *)i);
@@ -301,7 +501,48 @@ void FSView::contextMenu(TreeMapItem *i, const QPoint &p)
         if (i) {
             requestUpdate(i);
         }
+    } else if (action == actionSaveSnapshot) {
+        QString file = QFileDialog::getSaveFileName(this, tr("Save Snapshot"));
+        if (!file.isEmpty() && !ScanSnapshot::save(_sm.top(), file)) {
+            qDebug() << "FSView: can not save snapshot " << file;
+        }
+    } else if (action == actionCompare) {
+        QString file = QFileDialog::getOpenFileName(this, tr("Compare with Snapshot"));
+        if (!file.isEmpty()) {
+            showDiff(file);
+        }
+    } else if (action == actionDuplicates) {
+        findDuplicates();
+    } else if (action == actionScanStats) {
+        if (!_scanStatsView) {
+            // a window of its own, deleted with us
+            _scanStatsView = new ScanStatsView(&_sm.statistics(), this);
+            _scanStatsView->setWindowFlags(Qt::Window);
+        }
+        _scanStatsView->show();
+        _scanStatsView->raise();
+    } else if (action == actionTrace) {
+        QString file = QFileDialog::getSaveFileName(this, tr("Save Profile Trace"),
+                                                    QString(), tr("Chrome Trace (*.json)"));
+        if (!file.isEmpty() && !Profiler::self()->writeTrace(file)) {
+            qDebug() << "FSView: can not save trace " << file;
+        }
+    }
+}
+
+void FSView::showDiff(const QString &snapshot)
+{
+    SnapshotSource oldTree(snapshot);
+    if (!oldTree.isValid() || !_sm.top() || !allFilesKept()) {
+        return;
     }
+    ScanDirSource newTree(_sm.top());
+
+    DiffView *v = new DiffView;
+    v->setAttribute(Qt::WA_DeleteOnClose);
+    v->compare(&oldTree, &newTree);
+    v->resize(size());
+    v->show();
 }
 
 void FSView::setColorMode(FSView::ColorMode cm)
@@ -311,6 +552,11 @@ void FSView::setColorMode(FSView::ColorMode cm)
     }
 
     _colorMode = cm;
+    if (_colorMode == Growth) {
+        loadGrowth();
+    } else if (_colorMode == Reclaimable && _reclaimableFiles.isEmpty()) {
+        findDuplicates();
+    }
     redraw();
 }
 
@@ -328,6 +574,10 @@ bool FSView::setColorMode(const QString &mode)
         setColorMode(Group);
     } else if (mode == QLatin1String("Mime")) {
         setColorMode(Mime);
+    } else if (mode == QLatin1String("Growth")) {
+        setColorMode(Growth);
+    } else if (mode == QLatin1String("Reclaimable")) {
+        setColorMode(Reclaimable);
     } else {
         return false;
     }
@@ -345,6 +595,8 @@ QString FSView::colorModeString() const
     case Owner: mode = QStringLiteral("Owner"); break;
     case Group: mode = QStringLiteral("Group"); break;
     case Mime:  mode = QStringLiteral("Mime"); break;
+    case Growth: mode = QStringLiteral("Growth"); break;
+    case Reclaimable: mode = QStringLiteral("Reclaimable"); break;
     default:    mode = QStringLiteral("Unknown"); break;
     }
     return mode;
@@ -363,6 +615,118 @@ void FSView::addColorItems(QMenu *popup, int id)
     addPopupItem(popup, tr("Owner"),     colorMode() == Owner, id++);
     addPopupItem(popup, tr("Group"),     colorMode() == Group, id++);
     addPopupItem(popup, tr("Mime Type"), colorMode() == Mime,  id++);
+    addPopupItem(popup, tr("Growth"),    colorMode() == Growth, id++);
+    addPopupItem(popup, tr("Reclaimable"), colorMode() == Reclaimable, id++);
+}
+
+void FSView::setGrowthDays(int days)
+{
+    if (_growthDays == days) {
+        return;
+    }
+
+    _growthDays = days;
+    if (_colorMode == Growth) {
+        loadGrowth();
+        redraw();
+    }
+}
+
+bool FSView::growth(quint64 id, double &rate) const
+{
+    QHash<quint64, double>::const_iterator it = _growth.constFind(id);
+    if (it == _growth.constEnd()) {
+        return false;
+    }
+    rate = *it;
+    return true;
+}
+
+void FSView::loadGrowth()
+{
+    _growth = _history.growth((qint64)_growthDays * 24 * 60 * 60);
+}
+
+void FSView::findDuplicates()
+{
+    if (!_sm.top() || _sm.scanRunning() || findingDuplicates() ||
+        !allFilesKept()) {
+        return;
+    }
+
+    stopDuplicates();
+    _duplicateFinder = new DuplicateFinder(this);
+    _duplicateFinder->setReadBudget(_duplicateBudget);
+    _duplicateFinder->setTop(_sm.top());
+    connect(_duplicateFinder, SIGNAL(finished()),
+            this, SLOT(duplicatesFound()));
+    _duplicateFinder->start(QThread::LowPriority);
+}
+
+bool FSView::findingDuplicates() const
+{
+    return _duplicateFinder && _duplicateFinder->isRunning();
+}
+
+void FSView::setDuplicateReadBudget(qint64 bytes)
+{
+    _duplicateBudget = bytes;
+}
+
+void FSView::stopDuplicates()
+{
+    if (_duplicateFinder) {
+        _duplicateFinder->disconnect(this);
+        _duplicateFinder->requestInterruption();
+        _duplicateFinder->wait();
+        delete _duplicateFinder;
+        _duplicateFinder = 0;
+    }
+
+    if (!_reclaimableFiles.isEmpty()) {
+        _reclaimableFiles.clear();
+        _reclaimableDirs.clear();
+        if (_colorMode == Reclaimable) {
+            redraw();
+        }
+    }
+}
+
+void FSView::duplicatesFound()
+{
+    if (!_duplicateFinder) {
+        return;
+    }
+
+    const QVector<ScanFile *> &files = _duplicateFinder->reclaimableFiles();
+    const QVector<ScanDir *> &dirs = _duplicateFinder->reclaimableDirs();
+    for (int i = 0; i < files.count(); i++) {
+        double s = files[i]->size();
+        _reclaimableFiles.insert(files[i]);
+        for (ScanDir *d = dirs[i]; d; d = d->parent()) {
+            _reclaimableDirs[d] += s;
+        }
+    }
+
+    if (0) qDebug() << "FSView::duplicatesFound: " << files.count()
+                    << " files, complete " << _duplicateFinder->complete()
+                    << ", read " << _duplicateFinder->bytesRead() << endl;
+
+    _duplicateFinder->deleteLater();
+    _duplicateFinder = 0;
+
+    emit duplicatesCompleted(reclaimable(_sm.top()));
+    redraw();
+}
+
+bool FSView::isReclaimable(ScanFile *f) const
+{
+    return _reclaimableFiles.contains(f);
+}
+
+double FSView::reclaimable(ScanDir *d) const
+{
+    return _reclaimableDirs.value(d, 0.0);
 }
 
 void FSView::colorActivated(QAction *a)
@@ -380,6 +744,10 @@ void FSView::colorActivated(QAction *a)
         setColorMode(Group);
     } else if (id == _colorID + 5) {
         setColorMode(Mime);
+    } else if (id == _colorID + 6) {
+        setColorMode(Growth);
+    } else if (id == _colorID + 7) {
+        setColorMode(Reclaimable);
     }
 }
 
@@ -391,11 +759,112 @@ void FSView::keyPressEvent(QKeyEvent *e)
         if (changed) {
             clearSelection(changed);
         }
+    } else if (e->key() == Qt::Key_F12) {
+        setStatsVisible(!_showStats);
     } else {
         TreeMapWidget::keyPressEvent(e);
     }
 }
 
+void FSView::setStatsVisible(bool visible)
+{
+    if (_showStats == visible) {
+        return;
+    }
+
+    _showStats = visible;
+    if (_showStats && !Profiler::isEnabled()) {
+        Profiler::self()->setEnabled(true);
+        _statsEnabledProfiler = true;
+    } else if (!_showStats && _statsEnabledProfiler) {
+        Profiler::self()->setEnabled(false);
+        _statsEnabledProfiler = false;
+    }
+
+    if (_showStats) {
+        updateStats();
+    } else {
+        update();
+    }
+}
+
+void FSView::updateStats()
+{
+    if (!_showStats) {
+        return;
+    }
+
+    update();
+    QTimer::singleShot(500, this, SLOT(updateStats()));
+}
+
+void FSView::setMemoryBudget(qint64 bytes)
+{
+    _memoryBudget = bytes;
+    // items only exist for what is visible: the scan tree is what grows
+    _sm.setMemoryBudget(bytes);
+}
+
+void FSView::setKeptFiles(int count)
+{
+    _sm.setKeptFiles(count);
+}
+
+bool FSView::allFilesKept()
+{
+    // memory budget or aggregate-only scanning
+    return !_sm.top() || (_sm.top()->droppedFileCount() == 0);
+}
+
+qint64 FSView::memoryUsage() const
+{
+    return _sm.memoryUsage() + (base() ? base()->memoryUsage() : 0);
+}
+
+void FSView::paintEvent(QPaintEvent *e)
+{
+    TreeMapWidget::paintEvent(e);
+
+    // on top of the tree map, not in its back buffer
+    QPainter p(this);
+    QFontMetrics fm = fontMetrics();
+
+    if (_sm.detailDropped()) {
+        QString banner = tr("Memory budget of %1 exceeded: files below %2 were not kept")
+                         .arg(Inode::sizeString(_memoryBudget))
+                         .arg(Inode::sizeString(_sm.droppedBelow()));
+        QRect r(0, height() - fm.height() - 6, width(), fm.height() + 6);
+        p.fillRect(r, QColor(160, 0, 0, 200));
+        p.setPen(Qt::white);
+        p.drawText(r, Qt::AlignCenter, banner);
+    }
+
+    if (!_showStats) {
+        return;
+    }
+
+    QStringList lines = Profiler::self()->statsText();
+    if (lines.isEmpty()) {
+        lines.append(tr("No profile data"));
+    }
+    lines.prepend(tr("Memory: scan %1, items %2, budget %3")
+                  .arg(Inode::sizeString(_sm.memoryUsage()))
+                  .arg(Inode::sizeString(base() ? base()->memoryUsage() : 0))
+                  .arg(_memoryBudget > 0 ? Inode::sizeString(_memoryBudget) : tr("none")));
+    int w = 0;
+    foreach (const QString &l, lines) {
+        w = qMax(w, fm.width(l));
+    }
+    int lineCount = qMax(1, qMin(lines.count(), (height() - 20) / fm.height()));
+    QRect r(10, 10, w + 10, lineCount * fm.height() + 10);
+
+    p.fillRect(r, QColor(0, 0, 0, 180));
+    p.setPen(Qt::white);
+    for (int i = 0; i < lineCount; i++) {
+        p.drawText(r.x() + 5, r.y() + 5 + i * fm.height() + fm.ascent(), lines[i]);
+    }
+}
+
 void FSView::saveFSOptions()
 {
 }
@@ -406,8 +875,41 @@ void FSView::quit()
     qApp->quit();
 }
 
+/* The area of the item of a directory, or of the nearest parent with
+ * an item laid out, a quarter for each level in between. Directories
+ * outside of the view have no items and get 0. */
+double FSView::scanPriority(ScanDir *d)
+{
+    double share = 1.0;
+    for (; d; d = d->parent(), share /= 4) {
+        // the listeners of ScanDirs are their Inodes
+        Inode *i = (Inode *)d->listener();
+        if (!i) {
+            continue;
+        }
+        QRect r = i->itemRect();
+        if (!r.isValid() && (i == base())) {
+            // not laid out yet after navigation
+            r = rect();
+        }
+        if (r.isValid()) {
+            return share * r.width() * r.height();
+        }
+    }
+    return 0.0;
+}
+
+/* Priorities are taken from the rectangles of a complete layout,
+ * once per redraw tick at most */
+void FSView::reprioritizeLater()
+{
+    _reprioritize = true;
+}
+
 void FSView::doRedraw()
 {
+    PROFILE_SCOPE("FSView::doRedraw");
+
     // we update progress every 1/4 second, and redraw every second
     static int redrawCounter = 0;
 
@@ -416,6 +918,12 @@ void FSView::doRedraw()
         redrawCounter = 0;
     }
 
+    // scan where the last complete layout shows most
+    if (redo && _reprioritize) {
+        _reprioritize = false;
+        _sm.reprioritize();
+    }
+
     if ((_progress > 0) && (_progressSize > 0) && _lastDir) {
         int percent = _progress * 100 / _progressSize;
         if (0) qDebug() << "FSView::progress "
@@ -430,7 +938,13 @@ void FSView::doRedraw()
         if (0) {
             qDebug() << "doRedraw " << _sm.scanLength();
         }
-        redraw();
+        // while scanning, only lay out again what changed. Labels of
+        // parents are updated with the full redraw when finished.
+        if (redo) {
+            redrawDamage();
+        } else {
+            redraw();
+        }
     } else {
         redo = true;
     }
@@ -441,8 +955,36 @@ void FSView::doRedraw()
     }
 }
 
+void FSView::redrawDamage()
+{
+    Inode *b = (Inode *) base();
+    if (!b || !b->damaged()) {
+        return;
+    }
+
+    TreeMapItemList roots;
+    if (b->collectDamage(roots)) {
+        redraw();
+        return;
+    }
+
+    if (0) qDebug() << "FSView::redrawDamage: " << roots.count()
+                             << " items" << endl;
+
+    foreach (TreeMapItem *i, roots) {
+        redrawDamaged(i);
+    }
+}
+
 void FSView::doUpdate()
 {
+    if (_paused && _sm.scanRunning()) {
+        QTimer::singleShot(PAUSE_POLL_INTERVAL, this, SLOT(doUpdate()));
+        return;
+    }
+
+    PROFILE_SCOPE("FSView::doUpdate");
+
     for (int i = 0; i < 5; i++) {
         switch (_progressPhase) {
         case 1:
@@ -513,6 +1055,15 @@ void FSView::doUpdate()
     if (_sm.scanRunning()) {
         QTimer::singleShot(0, this, SLOT(doUpdate()));
     } else {
+        if (!_scanStopped && !_restored) {
+            _history.append(_sm.top());
+            if (_colorMode == Growth) {
+                loadGrowth();
+                redraw();
+            } else if (_colorMode == Reclaimable) {
+                findDuplicates();
+            }
+        }
         emit completed(_dirsFinished);
     }
 }
@@ -26,12 +26,16 @@
 #include <qmap.h>
 #include <qfileinfo.h>
 #include <qstring.h>
+#include <QSet>
 
 #include "treemap.h"
 #include "inode.h"
 #include "scan.h"
+#include "history.h"
 
 class QMenu;
+class DuplicateFinder;
+class ScanStatsView;
 
 /* Cached Metric info config */
 class MetricEntry
@@ -65,11 +69,13 @@ class FSView : public TreeMapWidget, public ScanListener
     Q_OBJECT
 
 public:
-    enum ColorMode { None = 0, Depth, Name, Owner, Group, Mime };
+    enum ColorMode { None = 0, Depth, Name, Owner, Group, Mime, Growth, Reclaimable };
 
     explicit FSView(Inode *, QWidget *parent = Q_NULLPTR);
     ~FSView();
 
+    /* Shows <path>. Within the scanned tree (and for its parents)
+     * the scan data is kept, and only what is missing gets scanned. */
     void setPath(const QString &);
     QString path()
     {
@@ -91,12 +97,40 @@ public:
 
     void requestUpdate(Inode *);
 
+    /* Files too small to get a visible rectangle are shown as one
+     * "small files" item per directory; they are expanded again
+     * when zooming in. */
+    void setAggregateSmallFiles(bool);
+    bool aggregateSmallFiles() const
+    {
+        return _aggregate;
+    }
+    // minimal area a file needs to be shown on its own
+    double aggregationArea() const;
+
     /* Implementation of listener interface of ScanManager.
      * Used to calculate progress info */
     void scanFinished(ScanDir *) Q_DECL_OVERRIDE;
+    // directories with large visible rectangles are scanned first
+    double scanPriority(ScanDir *) Q_DECL_OVERRIDE;
 
     void stop();
 
+    /* A paused scan keeps its todo list and continues on resume */
+    void setPaused(bool);
+    bool isPaused() const
+    {
+        return _paused;
+    }
+
+    /* Scan results are appended to <file>. A later scan of the same
+     * path, e.g. after a restart, continues from there. */
+    void setCheckpointFile(const QString &file);
+    QString checkpointFile() const
+    {
+        return _checkpointFile;
+    }
+
     static bool getDirMetric(const QString &, double &, unsigned int &, unsigned int &);
     static void setDirMetric(const QString &, double, unsigned int, unsigned int);
     void saveFSOptions();
@@ -104,8 +138,65 @@ public:
     // for color mode
     void addColorItems(QMenu *, int);
 
+    /* Growth color mode: size change of directories within the last
+     * days, from the history of completed scans */
+    void setGrowthDays(int);
+    int growthDays() const
+    {
+        return _growthDays;
+    }
+    // returns false if there is no history for directory <id>
+    bool growth(quint64 id, double &rate) const;
+
+    /* Duplicate files: of files with equal content, all but one
+     * are reclaimable. Searched on request for a finished scan,
+     * reading at most <bytes> (0: no limit). */
+    void findDuplicates();
+    bool findingDuplicates() const;
+    void setDuplicateReadBudget(qint64 bytes);
+    qint64 duplicateReadBudget() const
+    {
+        return _duplicateBudget;
+    }
+    bool isReclaimable(ScanFile *) const;
+    // reclaimable size below a directory
+    double reclaimable(ScanDir *) const;
+
+    /* Memory of the scan tree: above <bytes> (0: no limit), small
+     * files of directories scanned afterwards are only counted, which
+     * is shown in a banner. Items are not part of it, they only exist
+     * for what is visible. By default a quarter of the physical memory.
+     * Snapshots and duplicate search need all files kept. */
+    void setMemoryBudget(qint64 bytes);
+    qint64 memoryBudget() const
+    {
+        return _memoryBudget;
+    }
+    qint64 memoryUsage() const;
+    bool allFilesKept();
+
+    /* Aggregate-only scanning for huge trees: below the directory
+     * shown, keep only the <count> largest files per directory (-1: all).
+     * Zooming into a directory reads all its files. */
+    void setKeptFiles(int count);
+    int keptFiles() const
+    {
+        return _sm.keptFiles();
+    }
+
+    /* Overlay with the statistics of the profiler, toggled with F12.
+     * Showing it enables the profiler. */
+    void setStatsVisible(bool);
+    bool statsVisible() const
+    {
+        return _showStats;
+    }
+
     QList<QUrl> selectedUrls();
 
+    // show the changes since a snapshot in a new window
+    void showDiff(const QString &snapshot);
+
 public slots:
     void selected(TreeMapItem *);
     void contextMenu(TreeMapItem *, const QPoint &);
@@ -113,16 +204,31 @@ public slots:
     void doUpdate();
     void doRedraw();
     void colorActivated(QAction *);
+    void duplicatesFound();
+    void updateStats();
+    void reprioritizeLater();
 
 signals:
     void started();
     void progress(int percent, int dirs, const QString &lastDir);
     void completed(int dirs);
+    void duplicatesCompleted(double reclaimable);
 
 protected:
     void keyPressEvent(QKeyEvent *) Q_DECL_OVERRIDE;
+    void resizeEvent(QResizeEvent *) Q_DECL_OVERRIDE;
+    void paintEvent(QPaintEvent *) Q_DECL_OVERRIDE;
 
 private:
+    // redraw items changed by the scan since the last frame
+    void redrawDamage();
+    void loadGrowth();
+    // results refer to the scan tree: drop before changing it
+    void stopDuplicates();
+    // progress of directories scanned from now on
+    void newProgressChunk();
+    void startUpdates();
+
     ScanManager _sm;
 
     // when a contextMenu is shown, we don't allow async. refreshing
@@ -143,6 +249,33 @@ private:
 
     ColorMode _colorMode;
     int _colorID;
+
+    ScanHistory _history;
+    QHash<quint64, double> _growth;
+    int _growthDays;
+    // no history for stopped scans
+    bool _scanStopped;
+
+    DuplicateFinder *_duplicateFinder;
+    qint64 _duplicateBudget;
+    QSet<ScanFile *> _reclaimableFiles;
+    QHash<ScanDir *, double> _reclaimableDirs;
+
+    bool _showStats;
+    qint64 _memoryBudget;
+    bool _paused;
+    // tree partly from a checkpoint: not a sample for the history
+    bool _restored;
+    // new rectangles: scan priorities are asked again
+    bool _reprioritize;
+    QString _checkpointFile;
+    ScanStatsView *_scanStatsView;
+    // profiler was switched on for the overlay
+    bool _statsEnabledProfiler;
+
+    bool _aggregate;
+    // widget area the items were created for
+    int _aggregatedArea;
 };
 
 #endif // FSVIEW_H
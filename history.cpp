@@ -0,0 +1,360 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "history.h"
+
+#include <algorithm>
+#include <sys/file.h>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include "scan.h"
+
+// start of every record
+#define HISTORY_MAGIC 0x46535648 /* "FSVH" */
+// record header: magic, time, entry count, body length
+#define HISTORY_HEADER_SIZE (4 + 8 + 4 + 4)
+
+static void putVarint(QByteArray &b, quint64 v)
+{
+    while (v >= 0x80) {
+        b.append((char)(v | 0x80));
+        v >>= 7;
+    }
+    b.append((char)v);
+}
+
+static bool getVarint(const uchar *&p, const uchar *end, quint64 &v)
+{
+    v = 0;
+    for (int shift = 0; (p < end) && (shift < 64); shift += 7) {
+        uchar c = *p++;
+        v |= (quint64)(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// signed differences as small unsigned numbers
+static quint64 zigzag(qint64 v)
+{
+    return ((quint64)v << 1) ^ (quint64)(v >> 63);
+}
+
+static qint64 unzigzag(quint64 v)
+{
+    return (qint64)(v >> 1) ^ -(qint64)(v & 1);
+}
+
+static void putInt(QByteArray &b, quint64 v, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        b.append((char)(v >> (8 * i)));
+    }
+}
+
+static quint64 getInt(const uchar *p, int bytes)
+{
+    quint64 v = 0;
+    for (int i = 0; i < bytes; i++) {
+        v |= (quint64)p[i] << (8 * i);
+    }
+    return v;
+}
+
+class HistoryEntryLessThan
+{
+public:
+    bool operator()(const HistoryEntry &e1, const HistoryEntry &e2) const
+    {
+        return e1.id < e2.id;
+    }
+};
+
+/* Collect aggregates of <d> and all directories below */
+static void collect(ScanDir *d, const QString &path,
+                    QVector<HistoryEntry> &entries)
+{
+    HistoryEntry e;
+    e.id = ScanHistory::pathId(path);
+    e.size = d->size();
+    e.fileCount = d->fileCount();
+    e.dirCount = d->dirCount();
+    entries.append(e);
+
+    QString prefix = path;
+    if (!prefix.endsWith(QLatin1Char('/'))) {
+        prefix += QLatin1Char('/');
+    }
+
+    ScanDirVector &dirs = d->dirs();
+    ScanDirVector::iterator it;
+    for (it = dirs.begin(); it != dirs.end(); ++it) {
+        collect(&(*it), prefix + (*it).name(), entries);
+    }
+}
+
+
+ScanHistory::ScanHistory(const QString &file)
+{
+    _file = file;
+    if (_file.isEmpty()) {
+        QString dir = QStandardPaths::writableLocation(QStandardPaths::GenericDataLocation);
+        _file = dir + QStringLiteral("/fsview/history");
+    }
+    _offset = 0;
+    _windowStart = 0;
+}
+
+/* FNV-1a of the UTF-8 path */
+quint64 ScanHistory::pathId(const QString &absPath)
+{
+    QByteArray b = absPath.toUtf8();
+    quint64 h = Q_UINT64_C(14695981039346656037);
+    for (int i = 0; i < b.size(); i++) {
+        h ^= (uchar)b[i];
+        h *= Q_UINT64_C(1099511628211);
+    }
+    return h;
+}
+
+bool ScanHistory::append(ScanDir *top, qint64 time)
+{
+    if (!top) {
+        return false;
+    }
+
+    QVector<HistoryEntry> entries;
+    collect(top, top->name(), entries);
+    return append(entries, time);
+}
+
+bool ScanHistory::append(QVector<HistoryEntry> &entries, qint64 time)
+{
+    QDir().mkpath(QFileInfo(_file).absolutePath());
+    QFile f(_file);
+    if (!f.open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qDebug() << "ScanHistory: can not write " << _file;
+        return false;
+    }
+
+    // differences have to be against the latest record, also if
+    // another process appended it
+    flock(f.handle(), LOCK_EX);
+    if (f.size() < _offset) {
+        reset();
+    }
+    readNew(f);
+    // with the lock held, an incomplete record is left from a failed write
+    if (f.size() > _offset) {
+        f.resize(_offset);
+    }
+
+    if (time == 0) {
+        time = QDateTime::currentDateTime().toTime_t();
+    }
+
+    std::sort(entries.begin(), entries.end(), HistoryEntryLessThan());
+
+    QByteArray body;
+    quint64 lastId = 0;
+    foreach (const HistoryEntry &e, entries) {
+        putVarint(body, e.id - lastId);
+        lastId = e.id;
+    }
+    for (int col = 0; col < 3; col++) {
+        foreach (const HistoryEntry &e, entries) {
+            QHash<quint64, HistoryEntry>::const_iterator it = _last.constFind(e.id);
+            qint64 v, prev = 0;
+            switch (col) {
+            case 0:
+                v = e.size;
+                if (it != _last.constEnd()) {
+                    prev = (*it).size;
+                }
+                break;
+            case 1:
+                v = e.fileCount;
+                if (it != _last.constEnd()) {
+                    prev = (*it).fileCount;
+                }
+                break;
+            default:
+                v = e.dirCount;
+                if (it != _last.constEnd()) {
+                    prev = (*it).dirCount;
+                }
+                break;
+            }
+            putVarint(body, zigzag(v - prev));
+        }
+    }
+
+    QByteArray record;
+    putInt(record, HISTORY_MAGIC, 4);
+    putInt(record, time, 8);
+    putInt(record, entries.count(), 4);
+    putInt(record, body.size(), 4);
+    record += body;
+
+    qint64 size = f.size();
+    bool ok = f.write(record) == record.size();
+    ok = f.flush() && ok;
+    if (!ok) {
+        // records appended later would follow a broken one
+        f.resize(size);
+    }
+    flock(f.handle(), LOCK_UN);
+    if (!ok) {
+        qDebug() << "ScanHistory: can not write " << _file;
+        return false;
+    }
+
+    foreach (const HistoryEntry &e, entries) {
+        _last.insert(e.id, e);
+        if ((time >= _windowStart) && !_first.contains(e.id)) {
+            _first.insert(e.id, e.size);
+        }
+    }
+    _times.append(time);
+    _offset += record.size();
+    return true;
+}
+
+QHash<quint64, double> ScanHistory::growth(qint64 seconds)
+{
+    qint64 now = QDateTime::currentDateTime().toTime_t();
+    QHash<quint64, double> result;
+
+    QFile f(_file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return result;
+    }
+    // records left or entered the window: decode all again
+    if ((f.size() < _offset) || windowMoved(now - seconds)) {
+        reset();
+    }
+    _windowStart = now - seconds;
+    readNew(f);
+
+    QHash<quint64, qint64>::const_iterator it;
+    for (it = _first.constBegin(); it != _first.constEnd(); ++it) {
+        qint64 latest = _last.value(it.key()).size;
+        if ((*it > 0) && (latest != *it)) {
+            result.insert(it.key(), (double)(latest - *it) / *it);
+        }
+    }
+    return result;
+}
+
+void ScanHistory::reset()
+{
+    _offset = 0;
+    _last.clear();
+    _times.clear();
+    _first.clear();
+}
+
+// is there a record between the current and the new window start?
+bool ScanHistory::windowMoved(qint64 windowStart) const
+{
+    qint64 from = qMin(windowStart, _windowStart);
+    qint64 to = qMax(windowStart, _windowStart);
+    foreach (qint64 time, _times) {
+        if ((time >= from) && (time < to)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Decode the records after _offset, updating _last. Records not
+ * older than _windowStart also update _first. */
+bool ScanHistory::readNew(QFile &f)
+{
+    if (!f.seek(_offset)) {
+        return false;
+    }
+    QByteArray data = f.read(f.size() - _offset);
+    const uchar *start = (const uchar *)data.constData();
+    const uchar *p = start;
+    const uchar *end = p + data.size();
+
+    QVector<quint64> ids;
+    while (end - p >= HISTORY_HEADER_SIZE) {
+        if (getInt(p, 4) != HISTORY_MAGIC) {
+            qDebug() << "ScanHistory: " << _file << " is corrupt";
+            // do not decode the rest again with the next call
+            p = end;
+            break;
+        }
+        qint64 time = (qint64)getInt(p + 4, 8);
+        int count = (int)getInt(p + 12, 4);
+        quint64 length = getInt(p + 16, 4);
+        const uchar *body = p + HISTORY_HEADER_SIZE;
+        if ((quint64)(end - body) < length) {
+            // incomplete last record
+            break;
+        }
+        const uchar *recordEnd = body + length;
+        bool inWindow = (time >= _windowStart);
+
+        ids.resize(count);
+        quint64 id = 0, v;
+        bool ok = true;
+        const uchar *q = body;
+        for (int i = 0; ok && (i < count); i++) {
+            ok = getVarint(q, recordEnd, v);
+            id += v;
+            ids[i] = id;
+        }
+        for (int col = 0; ok && (col < 3); col++) {
+            for (int i = 0; ok && (i < count); i++) {
+                ok = getVarint(q, recordEnd, v);
+                HistoryEntry &e = _last[ids[i]];
+                if (col == 0) {
+                    // a new entry is zero initialized by QHash
+                    e.id = ids[i];
+                    e.size += unzigzag(v);
+                    if (inWindow && !_first.contains(e.id)) {
+                        _first.insert(e.id, e.size);
+                    }
+                } else if (col == 1) {
+                    e.fileCount += unzigzag(v);
+                } else {
+                    e.dirCount += unzigzag(v);
+                }
+            }
+        }
+        if (!ok) {
+            qDebug() << "ScanHistory: " << _file << " is corrupt";
+            p = end;
+            break;
+        }
+        _times.append(time);
+        p = recordEnd;
+    }
+
+    _offset += p - start;
+    return true;
+}
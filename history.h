@@ -0,0 +1,96 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Disk usage history: directory sizes of completed scans
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+
+class ScanDir;
+
+/* Aggregates of one directory in one scan */
+struct HistoryEntry {
+    quint64 id;
+    qint64 size;
+    quint64 fileCount, dirCount;
+};
+
+/**
+ * Append-only log of the directory aggregates of completed scans.
+ *
+ * Every scan is one record, stored column by column: the sorted
+ * directory ids as differences to the previous id, then sizes, file
+ * counts and directory counts, each as difference to the value of
+ * the same directory in the latest earlier record containing it.
+ * All numbers are variable length integers, so directories which
+ * did not change take 4 bytes.
+ *
+ * Directories are identified by a hash of their absolute path.
+ * Appending locks the file, so that several processes can share it.
+ * Decoded records are kept, and only new ones are read again.
+ */
+class ScanHistory
+{
+public:
+    // uses the default file in the user data directory if empty
+    explicit ScanHistory(const QString &file = QString());
+
+    static quint64 pathId(const QString &absPath);
+
+    /* Append the aggregates of all directories of a finished scan.
+     * <time> is in seconds since the epoch, 0 for now. */
+    bool append(ScanDir *top, qint64 time = 0);
+    bool append(QVector<HistoryEntry> &entries, qint64 time = 0);
+
+    /**
+     * Relative size change of every directory within the last
+     * <seconds>: (latest - first in window) / first. Directories
+     * with only one sample in the window are not included.
+     */
+    QHash<quint64, double> growth(qint64 seconds);
+
+    QString fileName() const
+    {
+        return _file;
+    }
+
+private:
+    void reset();
+    bool readNew(QFile &f);
+    bool windowMoved(qint64 windowStart) const;
+
+    QString _file;
+    // records are decoded up to this file offset
+    qint64 _offset;
+    // latest values, needed for encoding the next record
+    QHash<quint64, HistoryEntry> _last;
+    // times of the decoded records
+    QVector<qint64> _times;
+    // first size of every directory in records not older than _windowStart
+    qint64 _windowStart;
+    QHash<quint64, qint64> _first;
+};
+
+#endif // HISTORY_H
@@ -21,53 +21,176 @@
  */
 
 #include "inode.h"
-#include <QMimeDatabase>
 #include <QMimeType>
 #include <QDateTime>
+#include <QCoreApplication>
+#include <QHash>
 #include <QDebug>
 #include "scan.h"
 #include "fsview.h"
+#include "mimetypes.h"
+#include "colortable.h"
+#include "history.h"
+#include "profiler.h"
+
+#include <pwd.h>
+#include <grp.h>
+
+// directories with more files get compact leaves instead of Inodes
+#define MAX_FILE_ITEMS 1000
+
+// _nameKey of an item without name
+#define NO_NAME_KEY 0x10000
+
+// estimated private data of a QFileInfo, without the path
+#define FILEINFO_SIZE 200
+
+/* Text for a size, as shown in field 1 */
+QString Inode::sizeString(double s)
+{
+    QString text;
+
+    if (s < 1000) {
+        text = QStringLiteral("%1 B").arg((int)(s + .5));
+    } else if (s < 10 * 1024) {
+        text = QStringLiteral("%1 kB").arg(QLocale::system().toString(s / 1024 + .005, 'f', 2));
+    } else if (s < 100 * 1024) {
+        text = QStringLiteral("%1 kB").arg(QLocale::system().toString(s / 1024 + .05, 'f', 1));
+    } else if (s < 1000 * 1024) {
+        text = QStringLiteral("%1 kB").arg((int)(s / 1024 + .5));
+    } else if (s < 10 * 1024 * 1024) {
+        text = QStringLiteral("%1 MB").arg(QLocale::system().toString(s / 1024 / 1024 + .005, 'f', 2));
+    } else if (s < 100 * 1024 * 1024) {
+        text = QStringLiteral("%1 MB").arg(QLocale::system().toString(s / 1024 / 1024 + .05, 'f', 1));
+    } else if (s < 1000 * 1024 * 1024) {
+        text = QStringLiteral("%1 MB").arg((int)(s / 1024 / 1024 + .5));
+    } else {
+        text =  QStringLiteral("%1 GB").arg(QLocale::system().toString(s / 1024 / 1024 / 1024 + .005, 'f', 2));
+    }
+
+    return text;
+}
+
+/* User and group names are looked up only once per process */
+static QString userName(uid_t uid)
+{
+    static QHash<uint, QString> *s = 0;
+    if (!s) {
+        s = new QHash<uint, QString>;
+    }
+
+    QHash<uint, QString>::const_iterator it = s->constFind(uid);
+    if (it != s->constEnd()) {
+        return *it;
+    }
+
+    struct passwd *pw = getpwuid(uid);
+    QString name = pw ? QString::fromLocal8Bit(pw->pw_name) : QString::number(uid);
+    s->insert(uid, name);
+    return name;
+}
+
+static QString groupName(gid_t gid)
+{
+    static QHash<uint, QString> *s = 0;
+    if (!s) {
+        s = new QHash<uint, QString>;
+    }
+
+    QHash<uint, QString>::const_iterator it = s->constFind(gid);
+    if (it != s->constEnd()) {
+        return *it;
+    }
+
+    struct group *gr = getgrgid(gid);
+    QString name = gr ? QString::fromLocal8Bit(gr->gr_name) : QString::number(gid);
+    s->insert(gid, name);
+    return name;
+}
+
+/* Texts 4 - 6 from the attributes of the scan */
+static QString statText(const ScanStat &st, int i)
+{
+    if (i == 4) {
+        return QDateTime::fromTime_t(st.mtime).toString();
+    }
+    if (i == 5) {
+        return userName(st.uid);
+    }
+    if (i == 6) {
+        return groupName(st.gid);
+    }
+    return QString();
+}
 
 // Inode
 
+qint64 Inode::memoryUsage() const
+{
+    qint64 m = TreeMapItem::memoryUsage()
+               + sizeof(Inode) - sizeof(TreeMapItem);
+    if (_infoSet) {
+        // private data, with the path in UTF-16 and native encoding
+        m += FILEINFO_SIZE + _info.filePath().size() * 3;
+    }
+    return m;
+}
+
 Inode::Inode()
 {
     _dirPeer = 0;
     _filePeer = 0;
-    init(QString());
+    _groupCount = 0;
+    _groupDropped = 0;
+    _groupSize = 0.0;
+    init();
 }
 
 Inode::Inode(ScanDir *d, Inode *parent)
     : TreeMapItem(parent)
 {
-    QString absPath;
-    if (parent) {
-        absPath = parent->path();
-        if (!absPath.endsWith(QLatin1Char('/'))) {
-            absPath += QLatin1Char('/');
-        }
-    }
-    absPath += d->name();
-
     _dirPeer = d;
     _filePeer = 0;
+    _groupCount = 0;
+    _groupDropped = 0;
+    _groupSize = 0.0;
 
-    init(absPath);
+    init();
 }
 
 Inode::Inode(ScanFile *f, Inode *parent)
     : TreeMapItem(parent)
 {
-    QString absPath;
-    if (parent) {
-        absPath = parent->path() + QLatin1Char('/');
-    }
-    absPath += f->name();
-
     _dirPeer = 0;
     _filePeer = f;
+    _groupCount = 0;
+    _groupDropped = 0;
+    _groupSize = 0.0;
+
+    init();
+}
+
+Inode::Inode(Inode *parent, unsigned int count, double size,
+             unsigned int dropped)
+    : TreeMapItem(parent)
+{
+    _dirPeer = 0;
+    _filePeer = 0;
+
+    _infoSet = false;
+    _sizeEstimation = 0.0;
+    _fileCountEstimation = 0;
+    _dirCountEstimation = 0;
+    _mimeId = -1;
+    _nameKey = -1;
+    _pathId = 0;
+    _mimePixmapSet = false;
+    _resortNeeded = false;
+    _damaged = false;
 
-    init(absPath);
+    _groupCount = count;
+    _groupDropped = dropped;
+    _groupSize = size;
 }
 
 Inode::~Inode()
@@ -96,22 +219,66 @@ void Inode::setPeer(ScanDir *d)
 
     _dirPeer = d;
     _filePeer = 0;
-    init(d->name());
+    init();
 }
 
+/* No path is stored per item: it is the path of the parent plus the
+ * name of the peer, and only put together when needed */
 QString Inode::path() const
 {
-    return _info.absoluteFilePath();
+    Inode *p = (Inode *)parent();
+    if (_groupCount > 0) {
+        return p->path();
+    }
+
+    QString name;
+    if (_dirPeer) {
+        name = _dirPeer->name();
+    } else if (_filePeer) {
+        name = _filePeer->name();
+    }
+    if (!p) {
+        // the root peer may be any directory of the scan
+        return _dirPeer ? _dirPeer->path() : name;
+    }
+
+    QString path = p->path();
+    if (!path.endsWith(QLatin1Char('/'))) {
+        path += QLatin1Char('/');
+    }
+    return path + name;
 }
 
-void Inode::init(const QString &path)
+const ScanStat *Inode::stat() const
 {
-    if (0) qDebug() << "Inode::init [" << path
+    if (_dirPeer) {
+        return &_dirPeer->stat();
+    }
+    if (_filePeer) {
+        return &_filePeer->stat();
+    }
+    return 0;
+}
+
+const QFileInfo &Inode::fileInfo() const
+{
+    if (!_infoSet) {
+        _info = QFileInfo(path());
+        _infoSet = true;
+    }
+    return _info;
+}
+
+void Inode::init()
+{
+    if (0) qDebug() << "Inode::init [" << path()
                              << "]" << endl;
 
-    _info = QFileInfo(path);
+    _infoSet = false;
 
-    if (!FSView::getDirMetric(path, _sizeEstimation,
+    // estimations are only needed for directories
+    if (!_dirPeer ||
+        !FSView::getDirMetric(path(), _sizeEstimation,
                               _fileCountEstimation,
                               _dirCountEstimation)) {
         _sizeEstimation = 0.0;
@@ -119,9 +286,12 @@ void Inode::init(const QString &path)
         _dirCountEstimation = 0;
     }
 
-    _mimeSet = false;
+    _mimeId = -1;
+    _nameKey = -1;
+    _pathId = 0;
     _mimePixmapSet = false;
     _resortNeeded = false;
+    _damaged = true;
 
     clear();
 
@@ -145,6 +315,7 @@ void Inode::sizeChanged(ScanDir *d)
                              << d->name() << ": size " << d->size() << endl;
 
     _resortNeeded = true;
+    _damaged = true;
 }
 
 void Inode::scanFinished(ScanDir *d)
@@ -153,6 +324,7 @@ void Inode::scanFinished(ScanDir *d)
                              << d->name() << ": size " << d->size() << endl;
 
     _resortNeeded = true;
+    _damaged = true;
 
     /* no estimation any longer */
     _sizeEstimation = 0.0;
@@ -190,6 +362,29 @@ void Inode::destroyed(ScanFile *f)
     }
 }
 
+/* Files smaller than this get less than the area needed to be
+ * drawn, taking the current rectangle of the directory (or the
+ * whole widget if not laid out yet) as reference */
+double Inode::aggregationSize() const
+{
+    FSView *v = (FSView *)widget();
+    double area = v->aggregationArea();
+    if (area <= 0) {
+        return 0.0;
+    }
+
+    double total = value();
+    QRect r = itemRect();
+    if (!r.isValid()) {
+        total = v->base()->value();
+        r = v->rect();
+    }
+    if ((total <= 0) || r.isEmpty()) {
+        return 0.0;
+    }
+    return area * total / ((double)r.width() * r.height());
+}
+
 TreeMapItemList *Inode::children()
 {
     if (!_dirPeer) {
@@ -201,15 +396,57 @@ TreeMapItemList *Inode::children()
             return 0;
         }
 
+        PROFILE_SCOPE("Inode::children");
         _children = new TreeMapItemList;
 
         setSorting(-1);
 
         ScanFileVector &files = _dirPeer->files();
-        if (files.count() > 0) {
-            ScanFileVector::iterator it;
+        ScanFileVector::iterator it;
+
+        // files too small to be ever drawn are put into one item,
+        // together with the files not kept by the scan
+        double minSize = aggregationSize();
+        unsigned int dropped = _dirPeer->droppedCount();
+        unsigned int smallCount = 0;
+        double smallSize = 0.0;
+        if (minSize > 0) {
             for (it = files.begin(); it != files.end(); ++it) {
-                new Inode(&(*it), this);
+                if ((*it).size() < minSize) {
+                    smallCount++;
+                    smallSize += (*it).size();
+                }
+            }
+            if ((smallCount < 2) && (dropped == 0)) {
+                // nothing to gain
+                minSize = 0.0;
+                smallCount = 0;
+                smallSize = 0.0;
+            }
+        }
+        if ((minSize > 0) || (dropped > 0)) {
+            new Inode(this, smallCount + dropped,
+                      smallSize + _dirPeer->droppedSize(), dropped);
+        }
+        int fileCount = files.count() - ((minSize > 0) ? smallCount : 0);
+
+        if (fileCount > MAX_FILE_ITEMS) {
+            // only a few of them can be visible: keep files compact
+            _leaves = new TreeMapLeafArray;
+            _leaves->reserve(fileCount);
+
+            int idx = 0;
+            for (it = files.begin(); it != files.end(); ++it, ++idx) {
+                if ((*it).size() >= minSize) {
+                    _leaves->append((*it).size(), idx);
+                }
+            }
+            _leaves->sort();
+        } else if (fileCount > 0) {
+            for (it = files.begin(); it != files.end(); ++it) {
+                if ((*it).size() >= minSize) {
+                    new Inode(&(*it), this);
+                }
             }
         }
 
@@ -225,20 +462,82 @@ TreeMapItemList *Inode::children()
         _resortNeeded = false;
     }
 
+    /* only directories with size changes below need resorting, and
+     * these are flagged themselves by sizeChanged() */
     if (_resortNeeded) {
-        resort();
+        resort(false);
         _resortNeeded = false;
     }
 
     return _children;
 }
 
+bool Inode::collectDamage(TreeMapItemList &roots)
+{
+    _damaged = false;
+
+    /* sizeChanged() is propagated to all parents, so damaged
+     * items are connected to the base item */
+    TreeMapItemList below;
+    bool changedBelow = false, moved = false;
+    if (_children) {
+        foreach (TreeMapItem *i, *_children) {
+            Inode *child = (Inode *)i;
+            if (!child->_damaged) {
+                continue;
+            }
+
+            changedBelow = true;
+            if (child->collectDamage(below)) {
+                moved = true;
+            }
+        }
+    }
+
+    // our children keep their rectangles: only redraw below
+    if (changedBelow && !moved) {
+        roots += below;
+        return false;
+    }
+
+    if (shareMoved()) {
+        return true;
+    }
+
+    roots.append(this);
+    return false;
+}
+
+/* Does our rectangle move because of size changes since last layout?
+ * For this, the size share in the parent has to change at least
+ * by one pixel along the longer side of the parent.
+ */
+bool Inode::shareMoved() const
+{
+    TreeMapItem *p = parent();
+    if (!p || (p->drawnValue() <= 0) || (p->value() <= 0)) {
+        return true;
+    }
+    if (!p->itemRect().isValid()) {
+        return true;
+    }
+
+    double oldShare = drawnValue() / p->drawnValue();
+    double newShare = value() / p->value();
+    int extent = qMax(p->width(), p->height());
+
+    return qAbs(newShare - oldShare) * extent >= 1.0;
+}
+
 double Inode::size() const
 {
     // sizes of files are always correct
     if (_filePeer) {
         return _filePeer->size();
     }
+    if (_groupCount > 0) {
+        return _groupSize;
+    }
     if (!_dirPeer) {
         return 0;
     }
@@ -256,6 +555,9 @@ unsigned int Inode::fileCount() const
 {
     unsigned int fileCount = 1;
 
+    if (_groupCount > 0) {
+        fileCount = _groupCount;
+    }
     if (_dirPeer) {
         fileCount = _dirPeer->fileCount();
     }
@@ -282,54 +584,94 @@ unsigned int Inode::dirCount() const
     return dirCount;
 }
 
+/* The colors come from the keys of the item and the ColorTable:
+ * no string work after the name key was computed once */
 QColor Inode::backColor() const
 {
-    QString n;
-    int id = 0;
+    ColorTable *t = ColorTable::self();
+    QColor c;
 
     switch (((FSView *)widget())->colorMode()) {
-    case FSView::Depth: {
-        int d = ((FSView *)widget())->pathDepth() + depth();
-        return QColor::fromHsv((100 * d) % 360, 192, 128);
-    }
+    case FSView::Depth:
+        c = t->depthColor(((FSView *)widget())->pathDepth() + depth());
+        break;
 
-    case FSView::Name:   n = text(0); break;
-    case FSView::Owner:  id = _info.ownerId(); break;
-    case FSView::Group:  id = _info.groupId(); break;
-    case FSView::Mime:   n = text(7); break;
+    case FSView::Name:
+        if (_nameKey < 0) {
+            QString n = text(0);
+            _nameKey = n.isEmpty() ? NO_NAME_KEY : ColorTable::nameKey(n);
+        }
+        if (_nameKey != NO_NAME_KEY) {
+            c = t->nameColor(_nameKey);
+        }
+        break;
 
-    default:
+    case FSView::Owner:
+        c = t->idColor(stat() ? stat()->uid : 0);
         break;
-    }
 
-    if (id > 0) {
-        n = QString::number(id);
-    }
+    case FSView::Group:
+        c = t->idColor(stat() ? stat()->gid : 0);
+        break;
 
-    if (n.isEmpty()) {
-        return widget()->palette().button().color();
+    case FSView::Mime:
+        // no content sniffing while painting
+        c = t->typeColor(_filePeer ? _filePeer->type() :
+                         _dirPeer ? MimeTypes::self()->directoryType() :
+                         (int)MimeTypes::Unknown);
+        break;
+
+    case FSView::Growth:
+        // the history only knows directories
+        if (_dirPeer) {
+            double rate;
+            if (_pathId == 0) {
+                _pathId = ScanHistory::pathId(path());
+            }
+            if (((FSView *)widget())->growth(_pathId, rate)) {
+                c = t->growthColor(rate);
+            }
+        }
+        break;
+
+    case FSView::Reclaimable:
+        if (_filePeer) {
+            if (((FSView *)widget())->isReclaimable(_filePeer)) {
+                c = t->reclaimColor(1.0);
+            }
+        } else if (_dirPeer && _dirPeer->size() > 0) {
+            c = t->reclaimColor(((FSView *)widget())->reclaimable(_dirPeer) /
+                                _dirPeer->size());
+        }
+        break;
+
+    default:
+        break;
     }
 
-    QByteArray tmpBuf = n.toLocal8Bit();
-    const char *str = tmpBuf.data();
-    int h = 0, s = 100;
-    while (*str) {
-        h = (h * 37 + s * (unsigned) * str) % 256;
-        s = (s * 17 + h * (unsigned) * str) % 192;
-        str++;
+    if (!c.isValid()) {
+        return widget()->palette().button().color();
     }
-    return QColor::fromHsv(h, 64 + s, 192);
+    return c;
 }
 
 QMimeType Inode::mimeType() const
 {
-    if (!_mimeSet) {
-        QMimeDatabase db;
-        _mimeType = db.mimeTypeForUrl(QUrl::fromLocalFile(path()));
-
-        _mimeSet = true;
+    if (_mimeId < 0) {
+        MimeTypes *types = MimeTypes::self();
+        if (_dirPeer) {
+            _mimeId = types->directoryType();
+        } else if (_filePeer) {
+            _mimeId = _filePeer->type();
+            if (_mimeId == MimeTypes::Unknown) {
+                // the name does not tell: look at the content
+                _mimeId = types->typeForFile(path());
+            }
+        } else {
+            _mimeId = MimeTypes::Unknown;
+        }
     }
-    return _mimeType;
+    return MimeTypes::self()->mimeType(_mimeId);
 }
 
 QString Inode::text(int i) const
@@ -343,31 +685,19 @@ QString Inode::text(int i) const
             }
         } else if (_filePeer) {
             name = _filePeer->name();
+        } else if (_groupDropped > 0) {
+            // detail dropped because of the memory budget
+            name = QCoreApplication::translate("Inode", "%n small file(s), not kept",
+                                               "", _groupCount);
+        } else if (_groupCount > 0) {
+            name = QCoreApplication::translate("Inode", "%n small file(s)",
+                                               "", _groupCount);
         }
 
         return name;
     }
     if (i == 1) {
-        QString text;
-        double s = size();
-
-        if (s < 1000) {
-            text = QStringLiteral("%1 B").arg((int)(s + .5));
-        } else if (s < 10 * 1024) {
-            text = QStringLiteral("%1 kB").arg(QLocale::system().toString(s / 1024 + .005, 'f', 2));
-        } else if (s < 100 * 1024) {
-            text = QStringLiteral("%1 kB").arg(QLocale::system().toString(s / 1024 + .05, 'f', 1));
-        } else if (s < 1000 * 1024) {
-            text = QStringLiteral("%1 kB").arg((int)(s / 1024 + .5));
-        } else if (s < 10 * 1024 * 1024) {
-            text = QStringLiteral("%1 MB").arg(QLocale::system().toString(s / 1024 / 1024 + .005, 'f', 2));
-        } else if (s < 100 * 1024 * 1024) {
-            text = QStringLiteral("%1 MB").arg(QLocale::system().toString(s / 1024 / 1024 + .05, 'f', 1));
-        } else if (s < 1000 * 1024 * 1024) {
-            text = QStringLiteral("%1 MB").arg((int)(s / 1024 / 1024 + .5));
-        } else {
-            text =  QStringLiteral("%1 GB").arg(QLocale::system().toString(s / 1024 / 1024 / 1024 + .005, 'f', 2));
-        }
+        QString text = sizeString(size());
 
         if (_sizeEstimation > 0) {
             text += '+';
@@ -377,7 +707,7 @@ QString Inode::text(int i) const
 
     if ((i == 2) || (i == 3)) {
         /* file/dir count makes no sense for files */
-        if (_filePeer) {
+        if (_filePeer || ((_groupCount > 0) && (i == 3))) {
             return QString();
         }
 
@@ -397,21 +727,116 @@ QString Inode::text(int i) const
         return text;
     }
 
-    if (i == 4) {
-        return _info.lastModified().toString();
+    if ((i >= 4) && (i <= 6)) {
+        // no attributes for aggregated small files
+        return stat() ? statText(*stat(), i) : QString();
     }
-    if (i == 5) {
-        return _info.owner();
+    if (i == 7) {
+        return mimeType().comment();
     }
-    if (i == 6) {
-        return _info.group();
+    if (i == 8) {
+        double r = 0.0;
+        if (_filePeer) {
+            if (((FSView *)widget())->isReclaimable(_filePeer)) {
+                r = _filePeer->size();
+            }
+        } else if (_dirPeer) {
+            r = ((FSView *)widget())->reclaimable(_dirPeer);
+        }
+        return (r > 0.0) ? sizeString(r) : QString();
+    }
+    return QString();
+}
+
+QString Inode::leafText(int leaf, int i) const
+{
+    if (!_dirPeer) {
+        return QString();
+    }
+
+    ScanFile &f = _dirPeer->files()[_leaves->nameIndex(leaf)];
+    if (i == 0) {
+        return f.name();
+    }
+    if (i == 1) {
+        return sizeString(f.size());
+    }
+    if ((i >= 4) && (i <= 6)) {
+        return statText(f.stat(), i);
     }
     if (i == 7) {
-        return mimeType().comment();
+        return MimeTypes::self()->mimeType(f.type()).comment();
+    }
+    if ((i == 8) && ((FSView *)widget())->isReclaimable(&f)) {
+        return sizeString(f.size());
     }
+
+    // other fields need a full Inode
     return QString();
 }
 
+QColor Inode::leafBackColor(int leaf) const
+{
+    ColorTable *t = ColorTable::self();
+    ScanFile &f = _dirPeer->files()[_leaves->nameIndex(leaf)];
+    QColor c;
+
+    switch (((FSView *)widget())->colorMode()) {
+    case FSView::Depth:
+        c = t->depthColor(((FSView *)widget())->pathDepth() + depth() + 1);
+        break;
+
+    case FSView::Name:
+        if (f.nameKey() < 0) {
+            f.setNameKey(ColorTable::nameKey(f.name()));
+        }
+        c = t->nameColor(f.nameKey());
+        break;
+
+    case FSView::Owner:
+        c = t->idColor(f.stat().uid);
+        break;
+
+    case FSView::Group:
+        c = t->idColor(f.stat().gid);
+        break;
+
+    case FSView::Mime:
+        c = t->typeColor(f.type());
+        break;
+
+    case FSView::Reclaimable:
+        if (((FSView *)widget())->isReclaimable(&f)) {
+            c = t->reclaimColor(1.0);
+        }
+        break;
+
+    default:
+        break;
+    }
+
+    if (!c.isValid()) {
+        return widget()->palette().button().color();
+    }
+    return c;
+}
+
+TreeMapItem *Inode::materializeLeaf(int leaf)
+{
+    if (!_dirPeer || !_leaves) {
+        return 0;
+    }
+
+    // the new item must not be sorted in before it is set up
+    bool ascending;
+    int textNo = sorting(&ascending);
+    setSorting(-1);
+    Inode *i = new Inode(&_dirPeer->files()[_leaves->nameIndex(leaf)], this);
+    setSorting(textNo, ascending);
+
+    return i;
+}
+
 QPixmap Inode::pixmap(int i) const
 {
     return QPixmap();
@@ -47,8 +47,12 @@ public:
     Inode();
     Inode(ScanDir *, Inode *);
     Inode(ScanFile *, Inode *);
+    // aggregation of <count> small files in <parent>, <dropped>
+    // of them not kept by the scan because of the memory budget
+    Inode(Inode *parent, unsigned int count, double size,
+          unsigned int dropped = 0);
     ~Inode();
-    void init(const QString &);
+    void init();
 
     void setPeer(ScanDir *);
 
@@ -64,10 +68,18 @@ public:
     QColor backColor() const Q_DECL_OVERRIDE;
     QMimeType mimeType() const;
 
-    const QFileInfo &fileInfo() const
-    {
-        return _info;
-    }
+    // text for a size, as shown in field 1
+    static QString sizeString(double);
+
+    // files of large directories are compact leaves
+    QString leafText(int leaf, int i) const Q_DECL_OVERRIDE;
+    QColor leafBackColor(int leaf) const Q_DECL_OVERRIDE;
+    TreeMapItem *materializeLeaf(int leaf) Q_DECL_OVERRIDE;
+
+    // created on first use
+    const QFileInfo &fileInfo() const;
+    // attributes from the scan; 0 for aggregated small files
+    const ScanStat *stat() const;
     ScanDir *dirPeer()
     {
         return _dirPeer;
@@ -80,6 +92,28 @@ public:
     {
         return (_dirPeer != 0);
     }
+    // is this the aggregation of small files of the parent?
+    bool isGroup() const
+    {
+        return (_groupCount > 0);
+    }
+
+    // estimated memory of this Inode and all below, with file info
+    qint64 memoryUsage() const Q_DECL_OVERRIDE;
+
+    /* Size changed since the last frame? See collectDamage() */
+    bool damaged() const
+    {
+        return _damaged;
+    }
+
+    /**
+     * Collects the items to be laid out again because of size changes
+     * since the last call, and resets the damage flags.
+     * Returns true if this item itself moves in its parent, i.e.
+     * the parent has to be laid out again instead.
+     */
+    bool collectDamage(TreeMapItemList &);
 
     void sizeChanged(ScanDir *) Q_DECL_OVERRIDE;
     void scanFinished(ScanDir *) Q_DECL_OVERRIDE;
@@ -87,21 +121,31 @@ public:
     void destroyed(ScanFile *) Q_DECL_OVERRIDE;
 
 private:
+    double aggregationSize() const;
     void setMetrics(double, unsigned int);
+    bool shareMoved() const;
 
-    QFileInfo _info;
+    mutable QFileInfo _info;
+    mutable bool _infoSet;
     ScanDir *_dirPeer;
     ScanFile *_filePeer;
 
     double _sizeEstimation;
     unsigned int _fileCountEstimation, _dirCountEstimation;
 
+    // for aggregated small files
+    unsigned int _groupCount, _groupDropped;
+    double _groupSize;
+
     bool _resortNeeded;
+    bool _damaged;
 
     // Cached values, calculated lazy.
     // This means a change even in const methods, thus has to be "mutable"
-    mutable bool _mimeSet, _mimePixmapSet;
-    mutable QMimeType _mimeType;
+    mutable bool _mimePixmapSet;
+    mutable int _mimeId;
+    mutable int _nameKey;
+    mutable quint64 _pathId;
     mutable QPixmap _mimePixmap;
 };
 
@@ -5,6 +5,9 @@
  */
 
 #include "fsview.h"
+#include "diffview.h"
+#include "snapshot.h"
+#include "profiler.h"
 #include <QCommandLineParser>
 #include <QCommandLineOption>
 #include <QApplication>
@@ -13,9 +16,36 @@ int main(int argc, char *argv[])
 {
     QApplication app(argc, argv);
     QCommandLineParser parser;
-    parser.process(app);
 
     parser.addOption(QCommandLineOption(QStringList() << QStringLiteral("+[folder]"), QApplication::translate("main", "View filesystem starting from this folder")));
+    QCommandLineOption diffOption(QStringLiteral("diff"), QApplication::translate("main", "Show the changes between two snapshot files"));
+    parser.addOption(diffOption);
+    QCommandLineOption traceOption(QStringLiteral("trace"), QApplication::translate("main", "Profile scanning and drawing, write a Chrome trace to file on exit"), QStringLiteral("file"));
+    parser.addOption(traceOption);
+    QCommandLineOption memoryOption(QStringLiteral("memory-budget"), QApplication::translate("main", "Memory for the scan in MiB, 0 for no limit (default: a quarter of the RAM)"), QStringLiteral("MiB"));
+    parser.addOption(memoryOption);
+    QCommandLineOption keptOption(QStringLiteral("largest-files"), QApplication::translate("main", "Keep only totals and the <n> largest files of each directory below the one shown"), QStringLiteral("n"));
+    parser.addOption(keptOption);
+    QCommandLineOption checkpointOption(QStringLiteral("checkpoint"), QApplication::translate("main", "Write scan results to file, and continue from it if it is for the same folder"), QStringLiteral("file"));
+    parser.addOption(checkpointOption);
+    parser.process(app);
+
+    if (parser.isSet(diffOption)) {
+        if (parser.positionalArguments().count() != 2) {
+            parser.showHelp(1);
+        }
+
+        SnapshotSource oldTree(parser.positionalArguments().at(0));
+        SnapshotSource newTree(parser.positionalArguments().at(1));
+        if (!oldTree.isValid() || !newTree.isValid()) {
+            return 1;
+        }
+
+        DiffView v;
+        v.compare(&oldTree, &newTree);
+        v.show();
+        return app.exec();
+    }
 
     QString path = QStringLiteral(".");
 
@@ -33,8 +63,26 @@ int main(int argc, char *argv[])
     QObject::connect(&w, SIGNAL(contextMenuRequested(TreeMapItem*,QPoint)),
                      &w, SLOT(contextMenu(TreeMapItem*,QPoint)));
 
+    if (parser.isSet(traceOption)) {
+        Profiler::self()->setEnabled(true);
+    }
+    if (parser.isSet(memoryOption)) {
+        w.setMemoryBudget(parser.value(memoryOption).toLongLong() * 1024 * 1024);
+    }
+    if (parser.isSet(keptOption)) {
+        w.setKeptFiles(parser.value(keptOption).toInt());
+    }
+    if (parser.isSet(checkpointOption)) {
+        w.setCheckpointFile(parser.value(checkpointOption));
+    }
+
     w.setPath(path);
     w.show();
 
-    return app.exec();
+    int ret = app.exec();
+    if (parser.isSet(traceOption) &&
+        !Profiler::self()->writeTrace(parser.value(traceOption))) {
+        return 1;
+    }
+    return ret;
 }
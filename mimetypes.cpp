@@ -0,0 +1,129 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "mimetypes.h"
+
+#include <QDebug>
+
+// names without extension (README, Makefile, ...) remembered
+#define NAME_CACHE_SIZE 1000
+
+MimeTypes *MimeTypes::self()
+{
+    static MimeTypes *s = 0;
+    if (!s) {
+        s = new MimeTypes;
+    }
+    return s;
+}
+
+MimeTypes::MimeTypes()
+{
+    // id 0: Unknown
+    _types.append(QMimeType());
+    _directoryType = -1;
+    _byName.setMaxCost(NAME_CACHE_SIZE);
+}
+
+int MimeTypes::idFor(const QMimeType &t)
+{
+    // the default type says nothing: the content has to be checked
+    if (!t.isValid() || t.isDefault()) {
+        return Unknown;
+    }
+
+    QHash<QString, int>::const_iterator it = _byType.constFind(t.name());
+    if (it != _byType.constEnd()) {
+        return *it;
+    }
+
+    int id = _types.count();
+    _types.append(t);
+    _byType.insert(t.name(), id);
+
+    if (0) qDebug() << "MimeTypes: " << t.name() << " has id " << id << endl;
+
+    return id;
+}
+
+int MimeTypes::typeForName(const QString &name)
+{
+    // files starting with a dot, like .bashrc, have no extension
+    int dot = name.lastIndexOf(QLatin1Char('.'));
+    bool hasExtension = (dot > 0) && (dot < name.length() - 1);
+
+    if (!hasExtension) {
+        // mostly unique names: only keep the recent ones
+        int *cached = _byName.object(name);
+        if (cached) {
+            return *cached;
+        }
+
+        int id = idFor(_db.mimeTypeForFile(name, QMimeDatabase::MatchExtension));
+        _byName.insert(name, new int(id));
+        return id;
+    }
+
+    // the key keeps its case: *.C is C++, *.c is C
+    QString key = name.mid(dot + 1);
+    // suffixes with dots, like .tar.gz, must not share the key of .gz
+    if (_compoundSuffixes.isEmpty()) {
+        loadCompoundSuffixes();
+    }
+    for (int d = name.indexOf(QLatin1Char('.'), 1); (d > 0) && (d < dot);
+            d = name.indexOf(QLatin1Char('.'), d + 1)) {
+        if (_compoundSuffixes.contains(name.mid(d + 1).toLower())) {
+            key = name.mid(d + 1);
+            break;
+        }
+    }
+
+    QHash<QString, int>::const_iterator it = _byExtension.constFind(key);
+    if (it != _byExtension.constEnd()) {
+        return *it;
+    }
+
+    int id = idFor(_db.mimeTypeForFile(name, QMimeDatabase::MatchExtension));
+    _byExtension.insert(key, id);
+    return id;
+}
+
+void MimeTypes::loadCompoundSuffixes()
+{
+    foreach (const QMimeType &t, _db.allMimeTypes()) {
+        foreach (const QString &suffix, t.suffixes()) {
+            if (suffix.contains(QLatin1Char('.'))) {
+                _compoundSuffixes.insert(suffix.toLower());
+            }
+        }
+    }
+    // not asked again if there are none
+    _compoundSuffixes.insert(QString());
+}
+
+int MimeTypes::typeForFile(const QString &path)
+{
+    return idFor(_db.mimeTypeForFile(path, QMimeDatabase::MatchContent));
+}
+
+int MimeTypes::directoryType()
+{
+    if (_directoryType < 0) {
+        _directoryType = idFor(_db.mimeTypeForName(QStringLiteral("inode/directory")));
+    }
+    return _directoryType;
+}
@@ -0,0 +1,83 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Classification of files into MIME types with small integer ids
+ */
+
+#ifndef MIMETYPES_H
+#define MIMETYPES_H
+
+#include <QCache>
+#include <QHash>
+#include <QMimeDatabase>
+#include <QMimeType>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+/**
+ * Process-wide table of MIME types seen while scanning.
+ *
+ * Every type gets a small id, which is stored per file instead of
+ * the type. Ids are found by extension (the longest one the database
+ * knows, e.g. tar.gz, or by the full name for files without
+ * extension), so the QMimeDatabase is asked only once per extension.
+ * Of full names, only the recently used ones are kept.
+ * Id 0 (Unknown) means that the name does not tell the type;
+ * typeForFile() then looks at the content.
+ *
+ * Not thread-safe: scanning and painting both run in the GUI thread.
+ */
+class MimeTypes
+{
+public:
+    enum { Unknown = 0 };
+
+    static MimeTypes *self();
+
+    // type id from the file name only, no file access
+    int typeForName(const QString &name);
+    // type id from the content of a file
+    int typeForFile(const QString &path);
+    // type id of directories
+    int directoryType();
+
+    int count() const
+    {
+        return _types.count();
+    }
+    const QMimeType &mimeType(int id) const
+    {
+        return _types[id];
+    }
+
+private:
+    MimeTypes();
+    int idFor(const QMimeType &);
+    void loadCompoundSuffixes();
+
+    QMimeDatabase _db;
+    QHash<QString, int> _byExtension, _byType;
+    QCache<QString, int> _byName;
+    // lower case suffixes of the database containing a dot
+    QSet<QString> _compoundSuffixes;
+    QVector<QMimeType> _types;
+    int _directoryType;
+};
+
+#endif // MIMETYPES_H
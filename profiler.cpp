@@ -0,0 +1,198 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "profiler.h"
+
+#include <algorithm>
+
+#include <QCoreApplication>
+#include <QFile>
+#include <QMap>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QThread>
+
+// events kept for the trace; statistics go on afterwards
+#define MAX_EVENTS 2000000
+
+bool Profiler::_enabled = false;
+QElapsedTimer Profiler::_clock;
+
+Profiler *Profiler::self()
+{
+    static Profiler *s = 0;
+    if (!s) {
+        s = new Profiler;
+    }
+    return s;
+}
+
+Profiler::Profiler()
+{
+    _droppedEvents = 0;
+}
+
+void Profiler::setEnabled(bool enable)
+{
+    if (enable && !_clock.isValid()) {
+        _clock.start();
+    }
+    _enabled = enable;
+}
+
+void Profiler::clear()
+{
+    QMutexLocker locker(&_mutex);
+
+    _events.clear();
+    _stats.clear();
+    _counters.clear();
+    _droppedEvents = 0;
+}
+
+void Profiler::addEvent(const char *name, qint64 start, qint64 duration)
+{
+    QMutexLocker locker(&_mutex);
+
+    Stat &s = _stats[name];
+    s.count++;
+    s.total += duration;
+    if (duration > s.max) {
+        s.max = duration;
+    }
+
+    if (_events.count() >= MAX_EVENTS) {
+        _droppedEvents++;
+        return;
+    }
+    Event e;
+    e.name = name;
+    e.start = start;
+    e.duration = duration;
+    e.thread = (quintptr)QThread::currentThreadId();
+    e.counter = false;
+    _events.append(e);
+}
+
+void Profiler::addCounter(const char *name, qint64 value)
+{
+    qint64 t = now();
+    QMutexLocker locker(&_mutex);
+
+    qint64 &total = _counters[name];
+    total += value;
+
+    if (_events.count() >= MAX_EVENTS) {
+        _droppedEvents++;
+        return;
+    }
+    Event e;
+    e.name = name;
+    e.start = t;
+    e.duration = total;
+    e.thread = 0;
+    e.counter = true;
+    _events.append(e);
+}
+
+/* Chrome trace event format: complete events ("X") for scopes,
+ * counter events ("C") for counters; times in microseconds */
+bool Profiler::writeTrace(const QString &file)
+{
+    QFile f(file);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+    QMutexLocker locker(&_mutex);
+
+    // small thread ids are easier to read in the viewers
+    QHash<quintptr, int> threads;
+    qint64 pid = QCoreApplication::applicationPid();
+
+    QTextStream s(&f);
+    s << "{\"traceEvents\":[\n";
+    for (int i = 0; i < _events.count(); i++) {
+        const Event &e = _events[i];
+        if (i > 0) {
+            s << ",\n";
+        }
+        if (e.counter) {
+            s << "{\"name\":\"" << e.name << "\",\"ph\":\"C\",\"ts\":"
+              << QString::number(e.start / 1000.0, 'f', 3)
+              << ",\"pid\":" << pid << ",\"args\":{\"value\":" << e.duration << "}}";
+            continue;
+        }
+
+        if (!threads.contains(e.thread)) {
+            threads.insert(e.thread, threads.count() + 1);
+        }
+        s << "{\"name\":\"" << e.name << "\",\"cat\":\"fsview\",\"ph\":\"X\",\"ts\":"
+          << QString::number(e.start / 1000.0, 'f', 3)
+          << ",\"dur\":" << QString::number(e.duration / 1000.0, 'f', 3)
+          << ",\"pid\":" << pid << ",\"tid\":" << threads[e.thread] << "}";
+    }
+    s << "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"droppedEvents\":"
+      << _droppedEvents << "}}\n";
+
+    s.flush();
+    return f.error() == QFile::NoError;
+}
+
+QStringList Profiler::statsText()
+{
+    QMutexLocker locker(&_mutex);
+
+    // merge equal names
+    QMap<QString, Stat> stats;
+    QHash<const char *, Stat>::const_iterator it;
+    for (it = _stats.constBegin(); it != _stats.constEnd(); ++it) {
+        Stat &s = stats[QLatin1String(it.key())];
+        s.count += it.value().count;
+        s.total += it.value().total;
+        s.max = qMax(s.max, it.value().max);
+    }
+
+    QVector<QPair<qint64, QString> > lines;
+    QMap<QString, Stat>::const_iterator sit;
+    for (sit = stats.constBegin(); sit != stats.constEnd(); ++sit) {
+        const Stat &s = sit.value();
+        lines.append(qMakePair(s.total,
+                               QStringLiteral("%1: %2 x, %3 ms, avg %4 us, max %5 ms")
+                               .arg(sit.key()).arg(s.count)
+                               .arg(s.total / 1e6, 0, 'f', 1)
+                               .arg(s.total / 1e3 / s.count, 0, 'f', 1)
+                               .arg(s.max / 1e6, 0, 'f', 1)));
+    }
+    std::sort(lines.begin(), lines.end());
+
+    QStringList result;
+    for (int i = lines.count() - 1; i >= 0; i--) {
+        result.append(lines[i].second);
+    }
+
+    QMap<QString, qint64> counters;
+    QHash<const char *, qint64>::const_iterator cit;
+    for (cit = _counters.constBegin(); cit != _counters.constEnd(); ++cit) {
+        counters[QLatin1String(cit.key())] += cit.value();
+    }
+    QMap<QString, qint64>::const_iterator mit;
+    for (mit = counters.constBegin(); mit != counters.constEnd(); ++mit) {
+        result.append(QStringLiteral("%1: %2").arg(mit.key()).arg(mit.value()));
+    }
+    return result;
+}
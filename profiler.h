@@ -0,0 +1,135 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Timers and counters for scanning and drawing
+ */
+
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/**
+ * Collects the time spent in scopes marked with PROFILE_SCOPE() and
+ * values given to PROFILE_COUNT().
+ *
+ * Disabled by default: then a marked scope only tests a static flag.
+ * When enabled, every scope is recorded as an event for the Chrome
+ * trace format (chrome://tracing, Perfetto), and summed up per name
+ * for statsText(). Building with FSVIEW_NO_PROFILER removes the
+ * marks completely.
+ *
+ * Names must be string literals.
+ */
+class Profiler
+{
+public:
+    static Profiler *self();
+
+    static bool isEnabled()
+    {
+        return _enabled;
+    }
+    void setEnabled(bool);
+    // forget all events and statistics
+    void clear();
+
+    // nanoseconds since the profiler was enabled first
+    static qint64 now()
+    {
+        return _clock.nsecsElapsed();
+    }
+
+    void addEvent(const char *name, qint64 start, qint64 duration);
+    void addCounter(const char *name, qint64 value);
+
+    bool writeTrace(const QString &file);
+    // one line per scope and counter, most expensive first
+    QStringList statsText();
+
+private:
+    Profiler();
+
+    struct Event {
+        const char *name;
+        qint64 start;
+        // for counters: the total so far
+        qint64 duration;
+        quintptr thread;
+        bool counter;
+    };
+
+    struct Stat {
+        Stat()
+        {
+            count = 0;
+            total = 0;
+            max = 0;
+        }
+
+        qint64 count, total, max;
+    };
+
+    static bool _enabled;
+    static QElapsedTimer _clock;
+
+    QMutex _mutex;
+    QVector<Event> _events;
+    // literals with equal text can have different addresses
+    QHash<const char *, Stat> _stats;
+    QHash<const char *, qint64> _counters;
+    qint64 _droppedEvents;
+};
+
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char *name)
+    {
+        _name = Profiler::isEnabled() ? name : 0;
+        if (_name) {
+            _start = Profiler::now();
+        }
+    }
+    ~ProfileScope()
+    {
+        if (_name) {
+            Profiler::self()->addEvent(_name, _start, Profiler::now() - _start);
+        }
+    }
+
+private:
+    const char *_name;
+    qint64 _start;
+};
+
+#ifdef FSVIEW_NO_PROFILER
+#define PROFILE_SCOPE(name)
+#define PROFILE_COUNT(name, n)
+#else
+#define PROFILE_SCOPE(name) ProfileScope profileScope_(name)
+#define PROFILE_COUNT(name, n) \
+    do { if (Profiler::isEnabled()) Profiler::self()->addCounter(name, n); } while (0)
+#endif
+
+#endif // PROFILER_H
@@ -19,13 +19,26 @@
 #include "scan.h"
 
 #include <QDir>
+#include <QFileInfo>
 #include <QStringList>
 #include <QStorageInfo>
 #include <QSet>
+#include <QHash>
 #include <QDebug>
 #include <qplatformdefs.h>
 
-#include "inode.h"
+#include <errno.h>
+#include <algorithm>
+
+#include "mimetypes.h"
+#include "profiler.h"
+
+// memory of a QString besides its characters (header and pointer)
+#define STRING_OVERHEAD 32
+// default smallest file size kept once the budget is exceeded
+#define DROP_THRESHOLD (1024 * 1024)
+// maximal number of doublings of the drop threshold
+#define MAX_DROP_SHIFT 20
 
 // ScanManager
 
@@ -33,18 +46,33 @@ ScanManager::ScanManager()
 {
     _topDir = 0;
     _listener = 0;
+    _memory = 0;
+    _memoryBudget = 0;
+    _dropThreshold = DROP_THRESHOLD;
+    _droppedBelow = 0;
+    _keptFiles = -1;
+    _queued = 0;
+    _checkpoint = 0;
 }
 
 ScanManager::ScanManager(const QString &path)
 {
     _topDir = 0;
     _listener = 0;
+    _memory = 0;
+    _memoryBudget = 0;
+    _dropThreshold = DROP_THRESHOLD;
+    _droppedBelow = 0;
+    _keptFiles = -1;
+    _queued = 0;
+    _checkpoint = 0;
     setTop(path);
 }
 
 ScanManager::~ScanManager()
 {
     stopScan();
+    delete _checkpoint;
     delete _topDir;
 }
 
@@ -60,12 +88,90 @@ ScanDir *ScanManager::setTop(const QString &path, int data)
         delete _topDir;
         _topDir = 0;
     }
+    _memory = 0;
+    _droppedBelow = 0;
+    if (_checkpoint) {
+        // a new log for the new tree
+        _checkpoint->create(_checkpoint->fileName(), path);
+    }
     if (!path.isEmpty()) {
         _topDir = new ScanDir(path, this, 0, data);
     }
     return _topDir;
 }
 
+ScanDir *ScanManager::find(const QString &path)
+{
+    if (!_topDir) {
+        return 0;
+    }
+
+    QString top = _topDir->name();
+    if (path == top) {
+        return _topDir;
+    }
+    if (!top.endsWith(QLatin1Char('/'))) {
+        top += QLatin1Char('/');
+    }
+    if (!path.startsWith(top)) {
+        return 0;
+    }
+
+    ScanDir *d = _topDir;
+    foreach (const QString &n, path.mid(top.length()).split(QLatin1Char('/'), QString::SkipEmptyParts)) {
+        d = d->subDir(n);
+        if (!d) {
+            return 0;
+        }
+    }
+    return d;
+}
+
+ScanDir *ScanManager::extendTop(const QString &path, int data)
+{
+    if (!_topDir || !_topDir->scanStarted()) {
+        return 0;
+    }
+    QString prefix = path;
+    if (!prefix.endsWith(QLatin1Char('/'))) {
+        prefix += QLatin1Char('/');
+    }
+    if (!_topDir->name().startsWith(prefix)) {
+        return 0;
+    }
+
+    // one level up at a time
+    while (_topDir->name() != path) {
+        QString parentPath = QFileInfo(_topDir->name()).path();
+        ScanDir *d = new ScanDir(parentPath, this, 0, data);
+        ScanItem si(parentPath, d);
+        ScanItemList list;
+        d->scan(&si, list, data);
+
+        ScanDir *sub = d->graft(_topDir);
+        if (!sub) {
+            // removed meanwhile
+            qDeleteAll(list);
+            d->clear();
+            delete d;
+            return 0;
+        }
+        _topDir = d;
+        if (_checkpoint) {
+            writeCheckpoint(ScanCheckpoint::Top, parentPath, d);
+        }
+
+        foreach (ScanItem *item, list) {
+            if (item->dir == sub) {
+                delete item;
+            } else {
+                enqueue(item);
+            }
+        }
+    }
+    return _topDir;
+}
+
 bool ScanManager::scanRunning()
 {
     if (!_topDir) {
@@ -91,9 +197,40 @@ void ScanManager::startScan(ScanDir *from)
     from->clear();
     if (from->parent()) {
         from->parent()->setupChildRescan();
+    } else {
+        _statistics.reset();
+        _droppedBelow = 0;
+    }
+
+    ScanItem *si = new ScanItem(from->path(), from);
+    if (_checkpoint) {
+        writeCheckpoint(ScanCheckpoint::Rescan, si->absPath);
     }
+    enqueue(si);
+}
+
+void ScanManager::enqueue(ScanItem *si)
+{
+    _queue.insert(qMakePair(-si->priority, _queued++), si);
+}
+
+void ScanManager::reprioritize()
+{
+    if (!_listener || _queue.isEmpty()) {
+        return;
+    }
+
+    PROFILE_SCOPE("ScanManager::reprioritize");
 
-    _list.append(new ScanItem(from->path(), from));
+    // sequence numbers are kept: order of equal priorities stays
+    ScanQueue queue;
+    ScanQueue::const_iterator it;
+    for (it = _queue.constBegin(); it != _queue.constEnd(); ++it) {
+        ScanItem *si = it.value();
+        si->priority = _listener->scanPriority(si->dir);
+        queue.insert(qMakePair(-si->priority, it.key().second), si);
+    }
+    _queue.swap(queue);
 }
 
 void ScanManager::stopScan()
@@ -103,10 +240,11 @@ void ScanManager::stopScan()
     }
 
     if (0) qDebug() << "ScanManager::stopScan, scanLength "
-                             << _list.count() << endl;
+                             << _queue.count() << endl;
 
-    while (!_list.isEmpty()) {
-        ScanItem *si = _list.takeFirst();
+    while (!_queue.isEmpty()) {
+        ScanItem *si = _queue.begin().value();
+        _queue.erase(_queue.begin());
         si->dir->finish();
         delete si;
     }
@@ -114,29 +252,251 @@ void ScanManager::stopScan()
 
 int ScanManager::scan(int data)
 {
-    if (_list.isEmpty()) {
+    if (_queue.isEmpty()) {
         return false;
     }
-    ScanItem *si = _list.takeFirst();
+    ScanItem *si = _queue.begin().value();
+    _queue.erase(_queue.begin());
 
-    int newCount = si->dir->scan(si, _list, data);
+    ScanItemList list;
+    int newCount = si->dir->scan(si, list, data);
+    if (_checkpoint) {
+        writeCheckpoint(ScanCheckpoint::Dir, si->absPath, si->dir);
+    }
+    foreach (ScanItem *item, list) {
+        item->priority = si->priority / 4;
+        enqueue(item);
+    }
     delete si;
 
+    // the last records of a finished scan are not left in the buffer
+    if (_checkpoint && _queue.isEmpty()) {
+        _checkpoint->flush();
+    }
+
     return newCount;
 }
 
+bool ScanManager::setCheckpoint(const QString &file)
+{
+    delete _checkpoint;
+    _checkpoint = 0;
+    if (file.isEmpty()) {
+        return true;
+    }
+
+    _checkpoint = new ScanCheckpoint;
+    if (!_checkpoint->create(file, _topDir ? _topDir->name() : QString())) {
+        delete _checkpoint;
+        _checkpoint = 0;
+        return false;
+    }
+    return true;
+}
+
+void ScanManager::flushCheckpoint()
+{
+    if (_checkpoint) {
+        _checkpoint->flush();
+    }
+}
+
+void ScanManager::writeCheckpoint(ScanCheckpoint::Record r,
+                                  const QString &path, ScanDir *d)
+{
+    PROFILE_SCOPE("ScanManager::writeCheckpoint");
+
+    QByteArray data;
+    if (d) {
+        QDataStream s(&data, QIODevice::WriteOnly);
+        d->saveState(s);
+    }
+    _checkpoint->write(r, path, data);
+}
+
+// breadth-first order for the todo list after restore()
+static bool shallowerItem(ScanItem *i1, ScanItem *i2)
+{
+    return i1->absPath.count(QLatin1Char('/')) <
+           i2->absPath.count(QLatin1Char('/'));
+}
+
+/* Replays the records of the checkpoint like the scan did */
+bool ScanManager::restore(const QString &file, const QString &path, int data,
+                          bool *otherTree)
+{
+    setCheckpoint(QString());
+    if (otherTree) {
+        *otherTree = false;
+    }
+
+    ScanCheckpoint *cp = new ScanCheckpoint;
+    QString top;
+    if (!cp->open(file, top)) {
+        delete cp;
+        return false;
+    }
+
+    // the tree ends at the last new top directory
+    QString lastTop = top;
+    ScanCheckpoint::Record r;
+    QString p;
+    QByteArray record;
+    while (cp->read(r, p, record)) {
+        if (r == ScanCheckpoint::Top) {
+            lastTop = p;
+        }
+    }
+    QString prefix = lastTop;
+    if (!prefix.endsWith(QLatin1Char('/'))) {
+        prefix += QLatin1Char('/');
+    }
+    if ((path != lastTop) && !path.startsWith(prefix)) {
+        if (otherTree) {
+            *otherTree = true;
+        }
+        delete cp;
+        return false;
+    }
+    if (!cp->open(file, top)) {
+        delete cp;
+        return false;
+    }
+
+    PROFILE_SCOPE("ScanManager::restore");
+
+    setTop(top, data);
+    _statistics.reset();
+
+    // directories listed, but not scanned yet
+    QHash<QString, ScanItem *> pending;
+    pending.insert(top, new ScanItem(top, _topDir));
+
+    while (cp->read(r, p, record)) {
+        QDataStream s(record);
+        ScanItemList list;
+        ScanDir *sub = 0;
+
+        if (r == ScanCheckpoint::Rescan) {
+            ScanDir *d = find(p);
+            if (!d) {
+                continue;
+            }
+            // as startScan(), which stops the scan running
+            foreach (ScanItem *si, pending) {
+                si->dir->finish();
+                delete si;
+            }
+            pending.clear();
+            d->clear();
+            if (d->parent()) {
+                d->parent()->setupChildRescan();
+            }
+            pending.insert(p, new ScanItem(p, d));
+            continue;
+        }
+
+        if (r == ScanCheckpoint::Top) {
+            ScanDir *d = new ScanDir(p, this, 0, data);
+            d->loadState(s, p, list, data);
+            sub = d->graft(_topDir);
+            if (!sub) {
+                qDeleteAll(list);
+                d->clear();
+                delete d;
+                continue;
+            }
+            _topDir = d;
+        } else {
+            ScanItem *si = pending.take(p);
+            if (!si) {
+                continue;
+            }
+            si->dir->loadState(s, p, list, data);
+            delete si;
+        }
+
+        foreach (ScanItem *item, list) {
+            if (item->dir == sub) {
+                delete item;
+            } else {
+                pending.insert(item->absPath, item);
+            }
+        }
+    }
+
+    // a finished scan is not continued, but done again
+    if (pending.isEmpty()) {
+        delete cp;
+        setTop(QString());
+        return false;
+    }
+
+    // below a directory not listed yet
+    if (!find(path)) {
+        if (otherTree) {
+            *otherTree = true;
+        }
+        qDeleteAll(pending);
+        delete cp;
+        setTop(QString());
+        return false;
+    }
+
+    // go on writing after the last complete record
+    if (cp->startAppend()) {
+        _checkpoint = cp;
+    } else {
+        delete cp;
+    }
+
+    QList<ScanItem *> items = pending.values();
+    std::stable_sort(items.begin(), items.end(), shallowerItem);
+    foreach (ScanItem *si, items) {
+        enqueue(si);
+    }
+    return true;
+}
+
+/* Files smaller than this are not kept by the next directory scanned,
+ * 0 while the memory budget is not exceeded */
+off_t ScanManager::fileThreshold() const
+{
+    if ((_memoryBudget <= 0) || (_memory <= _memoryBudget)) {
+        return 0;
+    }
+
+    int shift = (int)qMin((_memory - _memoryBudget) * 8 / _memoryBudget,
+                          (qint64)MAX_DROP_SHIFT);
+    return _dropThreshold << shift;
+}
+
+/* keep what is shown later from a stat done anyway */
+static void setStat(ScanStat &st, const QT_STATBUF &buff)
+{
+    st.uid = buff.st_uid;
+    st.gid = buff.st_gid;
+    st.mtime = buff.st_mtime;
+    st.mode = buff.st_mode;
+}
+
 // ScanFile
 
 ScanFile::ScanFile()
 {
     _size = 0;
+    _type = MimeTypes::Unknown;
+    _nameKey = -1;
     _listener = 0;
 }
 
-ScanFile::ScanFile(const QString &n, off_t s)
+ScanFile::ScanFile(const QString &n, off_t s, const ScanStat &st)
 {
     _name = n;
     _size = s;
+    _stat = st;
+    _type = MimeTypes::Unknown;
+    _nameKey = -1;
     _listener = 0;
 }
 
@@ -151,6 +511,9 @@ ScanFile::~ScanFile()
 
 ScanDir::ScanDir()
 {
+    _memory = 0;
+    _droppedCount = 0;
+    _droppedSize = 0;
     _dirty = true;
     _dirsFinished = -1; /* scan not started */
 
@@ -164,6 +527,9 @@ ScanDir::ScanDir(const QString &n, ScanManager *m,
                  ScanDir *p, int data)
     : _name(n)
 {
+    _memory = 0;
+    _droppedCount = 0;
+    _droppedSize = 0;
     _dirty = true;
     _dirsFinished = -1; /* scan not started */
 
@@ -198,15 +564,71 @@ QString ScanDir::path()
     return _name;
 }
 
+qint64 ScanDir::memoryUsage()
+{
+    qint64 m = _memory;
+    ScanDirVector::iterator it;
+    for (it = _dirs.begin(); it != _dirs.end(); ++it) {
+        m += (*it).memoryUsage();
+    }
+    return m;
+}
+
 void ScanDir::clear()
 {
     _dirty = true;
     _dirsFinished = -1; /* scan not started */
 
+    if (_manager) {
+        _manager->addMemory(-memoryUsage());
+    }
+    _memory = 0;
+    _droppedCount = 0;
+    _droppedSize = 0;
+
     _files.clear();
     _dirs.clear();
 }
 
+ScanDir *ScanDir::subDir(const QString &n)
+{
+    ScanDirVector::iterator it;
+    for (it = _dirs.begin(); it != _dirs.end(); ++it) {
+        if ((*it)._name == n) {
+            return &(*it);
+        }
+    }
+    return 0;
+}
+
+ScanDir *ScanDir::graft(ScanDir *top)
+{
+    QString n = QFileInfo(top->_name).fileName();
+    ScanDir *d = subDir(n);
+    if (!d) {
+        return 0;
+    }
+
+    // shares the vectors with top: ScanDirs and ScanFiles stay in place
+    *d = *top;
+    d->_name = n;
+    d->_parent = this;
+    d->_listener = 0;
+    // the listener of top gets destroyed()
+    delete top;
+
+    // not shared any longer, no copies here
+    ScanDirVector::iterator it;
+    for (it = d->_dirs.begin(); it != d->_dirs.end(); ++it) {
+        (*it)._parent = d;
+    }
+
+    if (d->scanFinished()) {
+        subScanFinished();
+    }
+    return d;
+}
+
 void ScanDir::update()
 {
     if (!_dirty) {
@@ -214,16 +636,20 @@ void ScanDir::update()
     }
     _dirty = false;
 
+    PROFILE_SCOPE("ScanDir::update");
+
     _fileCount = 0;
     _dirCount = 0;
+    _droppedTotal = 0;
     _size = 0;
 
     if (_dirsFinished == -1) {
         return;
     }
 
-    if (_files.count() > 0) {
-        _fileCount += _files.count();
+    if (_files.count() + _droppedCount > 0) {
+        _fileCount += _files.count() + _droppedCount;
+        _droppedTotal = _droppedCount;
         _size = _fileSize;
     }
     if (_dirs.count() > 0) {
@@ -231,9 +657,10 @@ void ScanDir::update()
         ScanDirVector::iterator it;
         for (it = _dirs.begin(); it != _dirs.end(); ++it) {
             (*it).update();
-            _fileCount += (*it)._fileCount;
-            _dirCount  += (*it)._dirCount;
-            _size      += (*it)._size;
+            _fileCount    += (*it)._fileCount;
+            _dirCount     += (*it)._dirCount;
+            _droppedTotal += (*it)._droppedTotal;
+            _size         += (*it)._size;
         }
     }
 }
@@ -251,52 +678,316 @@ bool ScanDir::isForbiddenDir(QString &d)
     return _parent && (s->contains(d));
 }
 
-int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+static bool largerFile(const ScanFile &f1, const ScanFile &f2)
+{
+    return f1.size() > f2.size();
+}
+
+/* lstat() with latency and errors counted for the device */
+static bool timedLstat(const QString &path, QT_STATBUF &buff,
+                       ScanStatistics *stats, DeviceStats *ds)
+{
+    if (!ds) {
+        return QT_LSTAT(path.toStdString().c_str(), &buff) == 0;
+    }
+
+    qint64 start = stats->now();
+    int res = QT_LSTAT(path.toStdString().c_str(), &buff);
+    int err = errno;
+    ds->statLatency.record(stats->now() - start);
+
+    if (res == 0) {
+        return true;
+    }
+    if (err == EACCES) {
+        ds->errAccess++;
+    } else if (err == ENOENT) {
+        ds->errNoEntry++;
+    } else {
+        ds->errOther++;
+    }
+    return false;
+}
+
+static void writeStat(QDataStream &s, const ScanStat &st)
+{
+    s << (quint32)st.uid << (quint32)st.gid << (qint64)st.mtime << (quint32)st.mode;
+}
+
+static void readStat(QDataStream &s, ScanStat &st)
+{
+    quint32 uid, gid, mode;
+    qint64 mtime;
+    s >> uid >> gid >> mtime >> mode;
+    st.uid = uid;
+    st.gid = gid;
+    st.mtime = mtime;
+    st.mode = mode;
+}
+
+void ScanDir::saveState(QDataStream &s)
+{
+    writeStat(s, _stat);
+    s << (qint64)_fileSize << (quint32)_droppedCount << (qint64)_droppedSize;
+
+    s << (quint32)_files.count();
+    ScanFileVector::iterator fit;
+    for (fit = _files.begin(); fit != _files.end(); ++fit) {
+        s << (*fit).name() << (qint64)(*fit).size();
+        writeStat(s, (*fit).stat());
+    }
+
+    s << (quint32)_dirs.count();
+    ScanDirVector::iterator it;
+    for (it = _dirs.begin(); it != _dirs.end(); ++it) {
+        s << (*it)._name;
+        writeStat(s, (*it)._stat);
+    }
+}
+
+int ScanDir::loadState(QDataStream &s, const QString &absPath,
+                       ScanItemList &list, int data)
 {
     clear();
     _dirsFinished = 0;
-    _fileSize = 0;
     _dirty = true;
 
-    if (isForbiddenDir(si->absPath)) {
-        if (_parent) {
-            _parent->subScanFinished();
+    qint64 fileSize, droppedSize;
+    quint32 droppedCount, count;
+    readStat(s, _stat);
+    s >> fileSize >> droppedCount >> droppedSize;
+    _fileSize = fileSize;
+    _droppedCount = droppedCount;
+    _droppedSize = droppedSize;
+
+    MimeTypes *types = MimeTypes::self();
+    s >> count;
+    _files.reserve(count);
+    for (quint32 i = 0; (i < count) && (s.status() == QDataStream::Ok); i++) {
+        QString name;
+        qint64 size;
+        ScanStat st;
+        s >> name >> size;
+        readStat(s, st);
+        _files.append(ScanFile(name, size, st));
+        _files.last().setType(types->typeForName(name));
+    }
+
+    s >> count;
+    _dirs.reserve(count);
+    for (quint32 i = 0; (i < count) && (s.status() == QDataStream::Ok); i++) {
+        QString name;
+        s >> name;
+        _dirs.append(ScanDir(name, _manager, this, data));
+        readStat(s, _dirs.last()._stat);
+
+        QString newpath = absPath;
+        if (!newpath.endsWith(QChar('/'))) {
+            newpath.append("/");
         }
-        return 0;
+        newpath.append(name);
+        list.append(new ScanItem(newpath, &(_dirs.last())));
     }
+    _dirCount += _dirs.count();
+    updateMemory();
+
+    callScanStarted();
+    callSizeChanged();
+
+    if (_dirs.count() == 0) {
+        callScanFinished();
 
-    QDir d(si->absPath);
-    if (!d.isReadable()) {
         if (_parent) {
             _parent->subScanFinished();
         }
-
-        return 0;
     }
 
-    const QStringList fileList = d.entryList(QDir::Files |
-                                 QDir::Hidden | QDir::NoSymLinks);
+    return _dirs.count();
+}
+
+/* Files of the directory, all but the <kept> largest ones (-1: all)
+ * and those below the threshold of the memory budget only counted */
+void ScanDir::readFiles(QDir &d, const QString &absPath,
+                        ScanStatistics *stats, DeviceStats *ds, int kept)
+{
+    QStringList fileList;
+    {
+        PROFILE_SCOPE("readdir files");
+        fileList = d.entryList(QDir::Files | QDir::Hidden | QDir::NoSymLinks);
+        if (ds) {
+            ds->listings++;
+        }
+    }
 
     if (fileList.count() > 0) {
+        PROFILE_SCOPE("lstat files");
+        PROFILE_COUNT("lstat", fileList.count());
+        MimeTypes *types = MimeTypes::self();
+        ScanStat st;
         QT_STATBUF buff;
+        off_t threshold = _manager ? _manager->fileThreshold() : 0;
+        unsigned int droppedBefore = _droppedCount;
 
         _files.reserve(fileList.count());
 
         QStringList::ConstIterator it;
         for (it = fileList.constBegin(); it != fileList.constEnd(); ++it) {
-            QString tmp(si->absPath + QLatin1Char('/') + (*it));
-            if (QT_LSTAT(tmp.toStdString().c_str(), &buff) != 0) {
+            QString tmp(absPath + QLatin1Char('/') + (*it));
+            if (!timedLstat(tmp, buff, stats, ds)) {
                 continue;
             }
-            _files.append(ScanFile(*it, buff.st_blocks * 512));
+            if (ds) {
+                ds->files++;
+                ds->bytes += buff.st_blocks * 512;
+            }
             _fileSize += buff.st_size;
+
+            // over the memory budget: only count small files
+            if ((off_t)buff.st_blocks * 512 < threshold) {
+                _droppedCount++;
+                _droppedSize += buff.st_blocks * 512;
+                continue;
+            }
+            setStat(st, buff);
+            _files.append(ScanFile(*it, buff.st_blocks * 512, st));
+        }
+        if (_droppedCount > droppedBefore) {
+            _manager->fileDropped(threshold);
+        }
+
+        // aggregate-only: keep the largest files
+        if ((kept >= 0) && (_files.count() > kept)) {
+            std::nth_element(_files.begin(), _files.begin() + kept,
+                             _files.end(), largerFile);
+            for (int i = kept; i < _files.count(); i++) {
+                _droppedCount++;
+                _droppedSize += _files[i].size();
+            }
+            _files.resize(kept);
+        }
+        if (_droppedCount > 0) {
+            _files.squeeze();
+        }
+
+        // only for files kept
+        ScanFileVector::iterator fit;
+        for (fit = _files.begin(); fit != _files.end(); ++fit) {
+            (*fit).setType(types->typeForName((*fit).name()));
         }
     }
+}
+
+/* Vectors and names; subdirectories add their own files when scanned */
+void ScanDir::updateMemory()
+{
+    qint64 memory = (qint64)_files.capacity() * sizeof(ScanFile) +
+                    (qint64)_dirs.capacity() * sizeof(ScanDir);
+    for (int i = 0; i < _files.count(); i++) {
+        memory += STRING_OVERHEAD + 2 * _files[i].name().length();
+    }
+    for (int i = 0; i < _dirs.count(); i++) {
+        memory += STRING_OVERHEAD + 2 * _dirs[i].name().length();
+    }
+    if (_manager) {
+        _manager->addMemory(memory - _memory);
+    }
+    _memory = memory;
+}
+
+void ScanDir::loadFiles()
+{
+    if (!scanStarted() || (_droppedCount == 0)) {
+        return;
+    }
+    // over the budget, the same files would be dropped again
+    if (_manager && (_manager->fileThreshold() > 0)) {
+        return;
+    }
 
-    const QStringList dirList = d.entryList(QDir::Dirs |
-                                            QDir::Hidden | QDir::NoSymLinks | QDir::NoDotAndDotDot);
+    QString p = path();
+    QDir d(p);
+    if (!d.isReadable()) {
+        return;
+    }
+
+    // items of the files kept so far get destroyed() calls
+    _files.clear();
+    _fileSize = 0;
+    _droppedCount = 0;
+    _droppedSize = 0;
+    readFiles(d, p, 0, 0, -1);
+    updateMemory();
+
+    callSizeChanged();
+}
+
+int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
+{
+    PROFILE_SCOPE("ScanDir::scan");
+
+    clear();
+    _dirsFinished = 0;
+    _fileSize = 0;
+    _dirty = true;
+
+    ScanStatistics *stats = _manager ? &_manager->statistics() : 0;
+
+    if (isForbiddenDir(si->absPath)) {
+        if (stats) {
+            stats->addSkippedMount(si->absPath);
+        }
+        if (_parent) {
+            _parent->subScanFinished();
+        }
+        return 0;
+    }
+
+    QT_STATBUF buff;
+    dev_t dev = si->dev;
+    if (!_parent || (dev == 0)) {
+        if (QT_LSTAT(si->absPath.toStdString().c_str(), &buff) == 0) {
+            dev = buff.st_dev;
+            // the top directory is not listed by a parent
+            if (!_parent) {
+                setStat(_stat, buff);
+            }
+        }
+    }
+
+    DeviceStats *ds = stats ? stats->device(dev, si->absPath) : 0;
+    if (ds && ds->firstTime < 0) {
+        ds->firstTime = stats->now();
+    }
+
+    QDir d(si->absPath);
+    if (!d.isReadable()) {
+        if (ds) {
+            ds->unreadableDirs++;
+        }
+        if (_parent) {
+            _parent->subScanFinished();
+        }
+
+        return 0;
+    }
+
+    // the top directory is shown with all its files
+    readFiles(d, si->absPath, stats, ds,
+              (_manager && _parent) ? _manager->keptFiles() : -1);
+
+    QStringList dirList;
+    {
+        PROFILE_SCOPE("readdir dirs");
+        dirList = d.entryList(QDir::Dirs | QDir::Hidden | QDir::NoSymLinks |
+                              QDir::NoDotAndDotDot);
+        if (ds) {
+            ds->listings++;
+        }
+    }
 
     if (dirList.count() > 0) {
+        PROFILE_SCOPE("lstat dirs");
+        PROFILE_COUNT("lstat", dirList.count());
         _dirs.reserve(dirList.count());
 
         QStringList::ConstIterator it;
@@ -307,19 +998,34 @@ int ScanDir::scan(ScanItem *si, ScanItemList &list, int data)
                 newpath.append("/");
             }
             newpath.append(*it);
-            list.append(new ScanItem(newpath, &(_dirs.last())));
+            ScanItem *item = new ScanItem(newpath, &(_dirs.last()));
+            if (timedLstat(newpath, buff, stats, ds)) {
+                setStat(_dirs.last()._stat, buff);
+                item->dev = buff.st_dev;
+            }
+            list.append(item);
         }
         _dirCount += _dirs.count();
     }
 
-    callScanStarted();
-    callSizeChanged();
+    updateMemory();
 
-    if (_dirs.count() == 0) {
-        callScanFinished();
+    if (ds) {
+        ds->dirs++;
+        ds->lastTime = stats->now();
+    }
 
-        if (_parent) {
-            _parent->subScanFinished();
+    {
+        PROFILE_SCOPE("ScanListener callbacks");
+        callScanStarted();
+        callSizeChanged();
+
+        if (_dirs.count() == 0) {
+            callScanFinished();
+
+            if (_parent) {
+                _parent->subScanFinished();
+            }
         }
     }
 
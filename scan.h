@@ -25,10 +25,35 @@
 
 #include <qfile.h>
 #include <QVector>
+#include <QMap>
+#include <QPair>
 
+#include <sys/types.h>
+#include <time.h>
+
+#include "scanstats.h"
+#include "checkpoint.h"
+
+class QDir;
 class ScanDir;
 class ScanFile;
 
+/* Attributes kept from the lstat() done while scanning */
+struct ScanStat {
+    ScanStat()
+    {
+        uid = 0;
+        gid = 0;
+        mtime = 0;
+        mode = 0;
+    }
+
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+    mode_t mode;
+};
+
 class ScanItem
 {
 public:
@@ -36,13 +61,21 @@ public:
     {
         absPath = p;
         dir = d;
+        dev = 0;
+        priority = 0.0;
     }
 
     QString absPath;
     ScanDir *dir;
+    // device of the directory if known from the parent scan, or 0
+    dev_t dev;
+    // higher is scanned first, see ScanManager::reprioritize()
+    double priority;
 };
 
 typedef QList<ScanItem *> ScanItemList;
+// pending items by (-priority, sequence number): FIFO for equal priority
+typedef QMap<QPair<double, quint64>, ScanItem *> ScanQueue;
 
 /**
  * Listener for events from directory scanning.
@@ -64,6 +97,11 @@ public:
     // destroyed events are not delivered to listeners of ScanManager
     virtual void destroyed(ScanDir *) {}
     virtual void destroyed(ScanFile *) {}
+    // asked for pending directories by ScanManager::reprioritize()
+    virtual double scanPriority(ScanDir *)
+    {
+        return 0.0;
+    }
 };
 
 /**
@@ -91,10 +129,44 @@ public:
         return _topDir;
     }
 
+    // directory of absolute <path> in the current tree, or 0
+    ScanDir *find(const QString &path);
+
+    /**
+     * Makes <path>, a parent of the current top directory, the new
+     * top: its directories are scanned, and the current tree is kept
+     * in place of the one it was scanned from. Only the new siblings
+     * get scanned, attributed with data. Returns the new top directory.
+     */
+    ScanDir *extendTop(const QString &path, int data = 0);
+
+    /**
+     * Checkpoints: scan results are appended to <file>, to continue
+     * with restore() after a restart. An empty name stops writing.
+     * A new top directory starts a new file.
+     */
+    bool setCheckpoint(const QString &file);
+    bool checkpointing() const
+    {
+        return (_checkpoint != 0);
+    }
+    void flushCheckpoint();
+    /**
+     * Replaces the tree by the one of checkpoint <file> containing
+     * <path>, with the directories not scanned yet in the todo list,
+     * and goes on writing to <file>. The tree may be above <path>, if
+     * the scan went up. Returns false if there is no checkpoint for
+     * <path> in <file>, or if its scan was finished. <otherTree> is
+     * set if <file> holds the checkpoint of another tree, which
+     * should not be overwritten.
+     */
+    bool restore(const QString &file, const QString &path, int data = 0,
+                 bool *otherTree = 0);
+
     bool scanRunning();
     int scanLength() const
     {
-        return _list.count();
+        return _queue.count();
     }
 
     /**
@@ -112,6 +184,14 @@ public:
      */
     void stopScan();
 
+    /**
+     * Directories are scanned by priority, breadth-first for equal
+     * ones. New subdirectories get a quarter of the priority of their
+     * parent, until this asks the listener for new priorities of all
+     * pending directories (e.g. after the layout changed).
+     */
+    void reprioritize();
+
     /**
      * Scan first directory from todo list.
      * Directories added to the todo list are attributed with data.
@@ -126,8 +206,86 @@ public:
         return _listener;
     }
 
+    // of the last scan started from the top directory
+    ScanStatistics &statistics()
+    {
+        return _statistics;
+    }
+
+    /**
+     * Estimated memory used by the ScanDir/ScanFile tree.
+     * If it exceeds the budget (0: no limit), directories scanned
+     * afterwards only keep files of at least dropThreshold() bytes;
+     * smaller ones are only counted in the totals of their directory.
+     * The threshold doubles with every further 1/8 of the budget.
+     */
+    qint64 memoryUsage() const
+    {
+        return _memory;
+    }
+    void setMemoryBudget(qint64 bytes)
+    {
+        _memoryBudget = bytes;
+    }
+    qint64 memoryBudget() const
+    {
+        return _memoryBudget;
+    }
+    void setDropThreshold(off_t size)
+    {
+        _dropThreshold = size;
+    }
+    // largest threshold a file was dropped below, 0 if none
+    off_t droppedBelow() const
+    {
+        return _droppedBelow;
+    }
+    bool detailDropped() const
+    {
+        return _droppedBelow > 0;
+    }
+
+    /**
+     * Aggregate-only scanning: below the top directory, only the
+     * <count> largest files of each directory are kept (0: none),
+     * the others are only counted in the totals of their directory.
+     * -1 (the default) keeps all files.
+     */
+    void setKeptFiles(int count)
+    {
+        _keptFiles = count;
+    }
+    int keptFiles() const
+    {
+        return _keptFiles;
+    }
+
+    // used by ScanDir
+    void addMemory(qint64 bytes)
+    {
+        _memory += bytes;
+    }
+    off_t fileThreshold() const;
+    // a file below <threshold> was not kept
+    void fileDropped(off_t threshold)
+    {
+        if (threshold > _droppedBelow) {
+            _droppedBelow = threshold;
+        }
+    }
+
 private:
-    ScanItemList _list;
+    void enqueue(ScanItem *);
+    void writeCheckpoint(ScanCheckpoint::Record, const QString &path,
+                         ScanDir * = 0);
+
+    ScanQueue _queue;
+    quint64 _queued;
+    ScanCheckpoint *_checkpoint;
+    ScanStatistics _statistics;
+    qint64 _memory, _memoryBudget;
+    off_t _dropThreshold, _droppedBelow;
+    int _keptFiles;
     ScanDir *_topDir;
     ScanListener *_listener;
 };
@@ -136,17 +294,39 @@ class ScanFile
 {
 public:
     ScanFile();
-    ScanFile(const QString &n, off_t s);
+    ScanFile(const QString &n, off_t s, const ScanStat &st = ScanStat());
     ~ScanFile();
 
     const QString &name()
     {
         return _name;
     }
-    off_t size()
+    off_t size() const
     {
         return _size;
     }
+    const ScanStat &stat()
+    {
+        return _stat;
+    }
+    // MIME type id, see MimeTypes
+    int type()
+    {
+        return _type;
+    }
+    void setType(int t)
+    {
+        _type = t;
+    }
+    // key for coloring by name, -1 if not set yet
+    int nameKey()
+    {
+        return _nameKey;
+    }
+    void setNameKey(int k)
+    {
+        _nameKey = k;
+    }
 
     /* set listener to get callbacks from this ScanDir */
     void setListener(ScanListener *l)
@@ -161,6 +341,9 @@ public:
 private:
     QString _name;
     off_t _size;
+    ScanStat _stat;
+    unsigned short _type;
+    int _nameKey;
     ScanListener *_listener;
 };
 
@@ -188,9 +371,29 @@ public:
      */
     int scan(ScanItem *si, ScanItemList &list, int data);
 
+    /* Contents of the directory after scan(), for checkpoints.
+     * loadState() builds them again like scan(). */
+    void saveState(QDataStream &);
+    int loadState(QDataStream &, const QString &absPath,
+                  ScanItemList &list, int data);
+
     /* clear scan objects below */
     void clear();
 
+    /* Reads the files again if not all were kept by the scan
+     * (aggregate-only scanning). Does nothing while the memory
+     * budget is exceeded. */
+    void loadFiles();
+
+    // subdirectory with name <n>, or 0
+    ScanDir *subDir(const QString &n);
+
+    /* Puts <top>, the former top directory with all below, in place of
+     * the subdirectory of the same name just created by a scan, and
+     * deletes <top>. Returns the new subdirectory, or 0 if there is
+     * none of that name: <top> is kept then. */
+    ScanDir *graft(ScanDir *top);
+
     /*
      * Setup for child rescan
      */
@@ -221,6 +424,11 @@ public:
     {
         return _name;
     }
+    // attributes of the directory itself, set by the scan of the parent
+    const ScanStat &stat()
+    {
+        return _stat;
+    }
     off_t size()
     {
         update();
@@ -236,6 +444,23 @@ public:
         update();
         return _dirCount;
     }
+    // files not kept because of the memory budget or aggregate-only scanning
+    unsigned int droppedCount()
+    {
+        return _droppedCount;
+    }
+    // the same for this directory and all below
+    unsigned int droppedFileCount()
+    {
+        update();
+        return _droppedTotal;
+    }
+    off_t droppedSize()
+    {
+        return _droppedSize;
+    }
+    // estimated memory of this directory and all below
+    qint64 memoryUsage();
     ScanDir *parent()
     {
         return _parent;
@@ -270,6 +495,9 @@ public:
 private:
     void update();
     bool isForbiddenDir(QString &);
+    void readFiles(QDir &, const QString &absPath,
+                   ScanStatistics *, DeviceStats *, int kept);
+    void updateMemory();
 
     /* this propagates file count and size to upper dirs */
     void subScanFinished();
@@ -281,9 +509,14 @@ private:
     ScanDirVector _dirs;
 
     QString _name;
+    ScanStat _stat;
+    // memory of the files and subdirectory entries
+    qint64 _memory;
+    unsigned int _droppedCount;
+    off_t _droppedSize;
     bool _dirty; /* needs a call to update() */
     off_t _size, _fileSize;
-    unsigned int _fileCount, _dirCount;
+    unsigned int _fileCount, _dirCount, _droppedTotal;
     int _dirsFinished, _data;
     ScanDir *_parent;
     ScanListener *_listener;
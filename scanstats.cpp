@@ -0,0 +1,196 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "scanstats.h"
+
+#include <QJsonArray>
+#include <QStorageInfo>
+
+// exact values below 2^LINEAR_BITS, then 2^SUB_BITS buckets per power of 2
+#define LINEAR_BITS 4
+#define SUB_BITS 3
+#define MAX_EXPONENT 40
+// more skipped mount points are only counted
+#define MAX_SKIPPED_LIST 100
+
+// LatencyHistogram
+
+LatencyHistogram::LatencyHistogram()
+{
+    _buckets.fill(0, bucket((Q_INT64_C(1) << (MAX_EXPONENT + 1)) - 1) + 1);
+    _count = 0;
+    _sum = 0;
+    _max = 0;
+}
+
+int LatencyHistogram::bucket(qint64 ns)
+{
+    if (ns < (1 << LINEAR_BITS)) {
+        return (ns < 0) ? 0 : (int)ns;
+    }
+
+    int e = 63 - __builtin_clzll((quint64)ns);
+    if (e > MAX_EXPONENT) {
+        e = MAX_EXPONENT;
+        ns = (Q_INT64_C(1) << (e + 1)) - 1;
+    }
+    int sub = (int)(ns >> (e - SUB_BITS)) & ((1 << SUB_BITS) - 1);
+    return (1 << LINEAR_BITS) + ((e - LINEAR_BITS) << SUB_BITS) + sub;
+}
+
+// lower bound of the values in bucket <b>
+qint64 LatencyHistogram::bucketValue(int b)
+{
+    if (b < (1 << LINEAR_BITS)) {
+        return b;
+    }
+
+    b -= (1 << LINEAR_BITS);
+    int e = (b >> SUB_BITS) + LINEAR_BITS;
+    int sub = b & ((1 << SUB_BITS) - 1);
+    return (Q_INT64_C(1) << e) + ((qint64)sub << (e - SUB_BITS));
+}
+
+void LatencyHistogram::record(qint64 ns)
+{
+    _buckets[bucket(ns)]++;
+    _count++;
+    _sum += ns;
+    if (ns > _max) {
+        _max = ns;
+    }
+}
+
+qint64 LatencyHistogram::percentile(double p) const
+{
+    if (_count == 0) {
+        return 0;
+    }
+
+    qint64 limit = (qint64)(_count * p / 100.0 + .5);
+    qint64 seen = 0;
+    for (int b = 0; b < _buckets.count(); b++) {
+        seen += _buckets[b];
+        if (seen >= limit && seen > 0) {
+            return qMin(bucketValue(b), _max);
+        }
+    }
+    return _max;
+}
+
+// DeviceStats
+
+double DeviceStats::dirsPerSecond() const
+{
+    if (firstTime < 0 || lastTime <= firstTime) {
+        return 0.0;
+    }
+    return dirs * 1e9 / (lastTime - firstTime);
+}
+
+// ScanStatistics
+
+ScanStatistics::ScanStatistics()
+{
+    _last = 0;
+    _skippedCount = 0;
+    _clock.start();
+}
+
+ScanStatistics::~ScanStatistics()
+{
+    qDeleteAll(_devices);
+}
+
+void ScanStatistics::reset()
+{
+    qDeleteAll(_devices);
+    _devices.clear();
+    _last = 0;
+    _skippedMounts.clear();
+    _skippedCount = 0;
+    _clock.restart();
+}
+
+DeviceStats *ScanStatistics::device(dev_t dev, const QString &path)
+{
+    if (_last && _last->device == dev) {
+        return _last;
+    }
+
+    foreach (DeviceStats *d, _devices) {
+        if (d->device == dev) {
+            _last = d;
+            return d;
+        }
+    }
+
+    // only once per device: reads the mount table
+    QStorageInfo info(path);
+    _last = new DeviceStats;
+    _last->device = dev;
+    _last->mountPoint = info.rootPath();
+    _last->fileSystem = QString::fromLatin1(info.fileSystemType());
+    _devices.append(_last);
+    return _last;
+}
+
+void ScanStatistics::addSkippedMount(const QString &path)
+{
+    _skippedCount++;
+    if (_skippedMounts.count() < MAX_SKIPPED_LIST) {
+        _skippedMounts.append(path);
+    }
+}
+
+QJsonObject ScanStatistics::toJson() const
+{
+    QJsonArray devices;
+    foreach (DeviceStats *d, _devices) {
+        QJsonObject o;
+        o[QStringLiteral("device")] = QString::number((quint64)d->device);
+        o[QStringLiteral("mount_point")] = d->mountPoint;
+        o[QStringLiteral("file_system")] = d->fileSystem;
+        o[QStringLiteral("dirs")] = d->dirs;
+        o[QStringLiteral("dirs_per_sec")] = d->dirsPerSecond();
+        o[QStringLiteral("files")] = d->files;
+        o[QStringLiteral("bytes")] = d->bytes;
+        o[QStringLiteral("eacces")] = d->errAccess;
+        o[QStringLiteral("enoent")] = d->errNoEntry;
+        o[QStringLiteral("other_errors")] = d->errOther;
+        o[QStringLiteral("unreadable_dirs")] = d->unreadableDirs;
+        o[QStringLiteral("listings")] = d->listings;
+
+        QJsonObject l;
+        const LatencyHistogram &h = d->statLatency;
+        l[QStringLiteral("count")] = h.count();
+        l[QStringLiteral("mean_ns")] = h.mean();
+        l[QStringLiteral("p50_ns")] = h.percentile(50);
+        l[QStringLiteral("p90_ns")] = h.percentile(90);
+        l[QStringLiteral("p99_ns")] = h.percentile(99);
+        l[QStringLiteral("p999_ns")] = h.percentile(99.9);
+        l[QStringLiteral("max_ns")] = h.max();
+        o[QStringLiteral("stat_latency")] = l;
+        devices.append(o);
+    }
+
+    QJsonObject result;
+    result[QStringLiteral("devices")] = devices;
+    result[QStringLiteral("skipped_mounts")] = QJsonArray::fromStringList(_skippedMounts);
+    result[QStringLiteral("skipped_mount_count")] = _skippedCount;
+    return result;
+}
@@ -0,0 +1,153 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Statistics of a scan, per filesystem
+ */
+
+#ifndef SCANSTATS_H
+#define SCANSTATS_H
+
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+#include <sys/types.h>
+
+/**
+ * Histogram of latencies in nanoseconds with log-linear buckets:
+ * below 16 ns exact, above 8 buckets per power of two, i.e. an
+ * error of at most 12.5% (like a HdrHistogram with one significant
+ * digit), for values up to about 18 minutes.
+ */
+class LatencyHistogram
+{
+public:
+    LatencyHistogram();
+
+    void record(qint64 ns);
+
+    qint64 count() const
+    {
+        return _count;
+    }
+    qint64 max() const
+    {
+        return _max;
+    }
+    double mean() const
+    {
+        return _count ? (double)_sum / _count : 0.0;
+    }
+    // value below which <p> percent of the recorded values are
+    qint64 percentile(double p) const;
+
+private:
+    static int bucket(qint64 ns);
+    static qint64 bucketValue(int);
+
+    QVector<qint64> _buckets;
+    qint64 _count, _sum, _max;
+};
+
+/* Statistics of one filesystem (device) */
+struct DeviceStats {
+    DeviceStats()
+    {
+        device = 0;
+        dirs = 0;
+        files = 0;
+        bytes = 0;
+        errAccess = 0;
+        errNoEntry = 0;
+        errOther = 0;
+        unreadableDirs = 0;
+        listings = 0;
+        firstTime = -1;
+        lastTime = 0;
+    }
+
+    // directories per second while this filesystem was scanned
+    double dirsPerSecond() const;
+
+    dev_t device;
+    QString mountPoint, fileSystem;
+    qint64 dirs, files, bytes;
+    // errors of lstat() by errno
+    qint64 errAccess, errNoEntry, errOther;
+    qint64 unreadableDirs;
+    // directory reads (opendir() and getdents())
+    qint64 listings;
+    LatencyHistogram statLatency;
+    // nanoseconds since start of the scan
+    qint64 firstTime, lastTime;
+};
+
+/**
+ * Statistics collected by ScanManager during a scan: per device
+ * rates, lstat() latencies and errors, and the mount points which
+ * were not entered.
+ */
+class ScanStatistics
+{
+public:
+    ScanStatistics();
+    ~ScanStatistics();
+
+    void reset();
+
+    // nanoseconds since reset()
+    qint64 now() const
+    {
+        return _clock.nsecsElapsed();
+    }
+
+    // created on first use; <path> is used to find the mount point
+    DeviceStats *device(dev_t dev, const QString &path);
+    QList<DeviceStats *> devices() const
+    {
+        return _devices;
+    }
+
+    void addSkippedMount(const QString &path);
+    // only the first ones are kept
+    const QStringList &skippedMounts() const
+    {
+        return _skippedMounts;
+    }
+    int skippedMountCount() const
+    {
+        return _skippedCount;
+    }
+
+    QJsonObject toJson() const;
+
+private:
+    Q_DISABLE_COPY(ScanStatistics)
+
+    QElapsedTimer _clock;
+    QList<DeviceStats *> _devices;
+    // the last device used, to avoid searching the list
+    DeviceStats *_last;
+    QStringList _skippedMounts;
+    int _skippedCount;
+};
+
+#endif // SCANSTATS_H
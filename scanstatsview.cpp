@@ -0,0 +1,104 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "scanstatsview.h"
+
+#include <QHeaderView>
+#include <QTimer>
+
+#include "scanstats.h"
+#include "inode.h"
+
+#define REFRESH_INTERVAL 1000
+
+static QString latencyString(qint64 ns)
+{
+    if (ns < 10000) {
+        return QStringLiteral("%1 ns").arg(ns);
+    }
+    if (ns < 10000000) {
+        return QStringLiteral("%1 us").arg(ns / 1000);
+    }
+    return QStringLiteral("%1 ms").arg(ns / 1000000);
+}
+
+ScanStatsView::ScanStatsView(ScanStatistics *stats, QWidget *parent)
+    : QTreeWidget(parent)
+{
+    _stats = stats;
+
+    setWindowTitle(tr("Scan Statistics - FSView"));
+    setRootIsDecorated(false);
+    setHeaderLabels(QStringList()
+                    << tr("Mount Point") << tr("Type")
+                    << tr("Directories") << tr("Dirs/s")
+                    << tr("Files") << tr("Size")
+                    << tr("lstat p50") << tr("p99") << tr("Max")
+                    << tr("EACCES") << tr("ENOENT") << tr("Other Errors")
+                    << tr("Unreadable Dirs"));
+    resize(900, 250);
+
+    _timer = new QTimer(this);
+    _timer->setInterval(REFRESH_INTERVAL);
+    connect(_timer, SIGNAL(timeout()), this, SLOT(refresh()));
+}
+
+void ScanStatsView::showEvent(QShowEvent *e)
+{
+    QTreeWidget::showEvent(e);
+    refresh();
+    _timer->start();
+}
+
+void ScanStatsView::hideEvent(QHideEvent *e)
+{
+    QTreeWidget::hideEvent(e);
+    _timer->stop();
+}
+
+void ScanStatsView::refresh()
+{
+    clear();
+    foreach (DeviceStats *d, _stats->devices()) {
+        const LatencyHistogram &h = d->statLatency;
+        QStringList texts;
+        texts << d->mountPoint << d->fileSystem
+              << QString::number(d->dirs)
+              << QString::number(d->dirsPerSecond(), 'f', 0)
+              << QString::number(d->files)
+              << Inode::sizeString(d->bytes)
+              << latencyString(h.percentile(50))
+              << latencyString(h.percentile(99))
+              << latencyString(h.max())
+              << QString::number(d->errAccess)
+              << QString::number(d->errNoEntry)
+              << QString::number(d->errOther)
+              << QString::number(d->unreadableDirs);
+        addTopLevelItem(new QTreeWidgetItem(texts));
+    }
+
+    if (_stats->skippedMountCount() > 0) {
+        QTreeWidgetItem *i = new QTreeWidgetItem(QStringList()
+                                                 << tr("%n skipped mount point(s)", "",
+                                                       _stats->skippedMountCount()));
+        foreach (const QString &m, _stats->skippedMounts()) {
+            new QTreeWidgetItem(i, QStringList() << m);
+        }
+        addTopLevelItem(i);
+        setRootIsDecorated(true);
+    }
+}
@@ -0,0 +1,54 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Panel with the scan statistics
+ */
+
+#ifndef SCANSTATSVIEW_H
+#define SCANSTATSVIEW_H
+
+#include <QTreeWidget>
+
+class QTimer;
+class ScanStatistics;
+
+/**
+ * Shows the ScanStatistics of a ScanManager, one row per
+ * filesystem and the skipped mount points below.
+ * Refreshes itself every second while visible.
+ */
+class ScanStatsView : public QTreeWidget
+{
+    Q_OBJECT
+
+public:
+    ScanStatsView(ScanStatistics *, QWidget *parent = Q_NULLPTR);
+
+public slots:
+    void refresh();
+
+protected:
+    void showEvent(QShowEvent *) Q_DECL_OVERRIDE;
+    void hideEvent(QHideEvent *) Q_DECL_OVERRIDE;
+
+private:
+    ScanStatistics *_stats;
+    QTimer *_timer;
+};
+
+#endif // SCANSTATSVIEW_H
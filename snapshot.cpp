@@ -0,0 +1,332 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "snapshot.h"
+
+#include <algorithm>
+
+#include <QDebug>
+
+#include "scan.h"
+
+#define SNAPSHOT_MAGIC 0x46535653 /* "FSVS" */
+#define SNAPSHOT_VERSION 1
+
+// sort order of entries in a directory
+class FileNameLessThan
+{
+public:
+    explicit FileNameLessThan(ScanFileVector &v) : _v(v) {}
+    bool operator()(int i1, int i2) const
+    {
+        return _v[i1].name() < _v[i2].name();
+    }
+
+private:
+    ScanFileVector &_v;
+};
+
+class DirNameLessThan
+{
+public:
+    explicit DirNameLessThan(ScanDirVector &v) : _v(v) {}
+    bool operator()(int i1, int i2) const
+    {
+        return _v[i1].name() < _v[i2].name();
+    }
+
+private:
+    ScanDirVector &_v;
+};
+
+/* Order of entries: files, directories, end; then by name */
+static int compareEntries(const DiffEntry &e1, const DiffEntry &e2)
+{
+    if (e1.kind != e2.kind) {
+        return (e1.kind < e2.kind) ? -1 : 1;
+    }
+    if (e1.kind == DiffEntry::End) {
+        return 0;
+    }
+    return QString::compare(e1.name, e2.name);
+}
+
+
+// ScanDirSource
+
+ScanDirSource::ScanDirSource(ScanDir *top)
+{
+    _top = top;
+    _lastDir = 0;
+    if (_top) {
+        push(_top);
+    }
+}
+
+QString ScanDirSource::topPath() const
+{
+    return _top ? _top->name() : QString();
+}
+
+qint64 ScanDirSource::topSize() const
+{
+    return _top ? (qint64)_top->size() : 0;
+}
+
+void ScanDirSource::push(ScanDir *d)
+{
+    Frame f;
+    f.dir = d;
+    f.pos = 0;
+
+    int n = d->files().count();
+    f.files.resize(n);
+    for (int i = 0; i < n; i++) {
+        f.files[i] = i;
+    }
+    std::sort(f.files.begin(), f.files.end(), FileNameLessThan(d->files()));
+
+    n = d->dirs().count();
+    f.dirs.resize(n);
+    for (int i = 0; i < n; i++) {
+        f.dirs[i] = i;
+    }
+    std::sort(f.dirs.begin(), f.dirs.end(), DirNameLessThan(d->dirs()));
+
+    _stack.append(f);
+}
+
+bool ScanDirSource::next(DiffEntry &e)
+{
+    if (_stack.isEmpty()) {
+        return false;
+    }
+
+    Frame &f = _stack.last();
+    int pos = f.pos++;
+    if (pos < f.files.count()) {
+        ScanFile &file = f.dir->files()[f.files[pos]];
+        e.kind = DiffEntry::File;
+        e.name = file.name();
+        e.size = file.size();
+        return true;
+    }
+
+    pos -= f.files.count();
+    if (pos < f.dirs.count()) {
+        _lastDir = &(f.dir->dirs()[f.dirs[pos]]);
+        e.kind = DiffEntry::Dir;
+        e.name = _lastDir->name();
+        e.size = _lastDir->size();
+        return true;
+    }
+
+    e.kind = DiffEntry::End;
+    e.name = QString();
+    e.size = 0;
+    _stack.removeLast();
+    return true;
+}
+
+void ScanDirSource::descend(bool enter)
+{
+    if (enter && _lastDir) {
+        push(_lastDir);
+    }
+    _lastDir = 0;
+}
+
+
+// SnapshotSource
+
+SnapshotSource::SnapshotSource(const QString &file)
+    : _file(file)
+{
+    _valid = false;
+    _topSize = 0;
+
+    if (!_file.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    _stream.setDevice(&_file);
+
+    quint32 magic, version;
+    _stream >> magic >> version;
+    if ((magic != SNAPSHOT_MAGIC) || (version != SNAPSHOT_VERSION)) {
+        qDebug() << "SnapshotSource: " << file << " is no snapshot";
+        return;
+    }
+    _stream >> _topPath >> _topSize;
+    _valid = (_stream.status() == QDataStream::Ok);
+}
+
+QString SnapshotSource::topPath() const
+{
+    return _topPath;
+}
+
+qint64 SnapshotSource::topSize() const
+{
+    return _topSize;
+}
+
+bool SnapshotSource::next(DiffEntry &e)
+{
+    if (!_valid || _stream.atEnd()) {
+        return false;
+    }
+
+    quint8 kind;
+    _stream >> kind;
+    e.kind = (DiffEntry::Kind)kind;
+    if (e.kind == DiffEntry::End) {
+        e.name = QString();
+        e.size = 0;
+    } else {
+        _stream >> e.name >> e.size;
+    }
+    return (_stream.status() == QDataStream::Ok);
+}
+
+void SnapshotSource::descend(bool enter)
+{
+    if (enter) {
+        return;
+    }
+
+    // read over the contents
+    DiffEntry e;
+    int level = 1;
+    while ((level > 0) && next(e)) {
+        if (e.kind == DiffEntry::Dir) {
+            level++;
+        } else if (e.kind == DiffEntry::End) {
+            level--;
+        }
+    }
+}
+
+
+// ScanSnapshot
+
+bool ScanSnapshot::save(ScanDir *top, const QString &file)
+{
+    // files only counted would be deleted in a diff
+    if (!top || (top->droppedFileCount() > 0)) {
+        return false;
+    }
+
+    QFile f(file);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+
+    QDataStream s(&f);
+    ScanDirSource source(top);
+    s << (quint32)SNAPSHOT_MAGIC << (quint32)SNAPSHOT_VERSION
+      << source.topPath() << source.topSize();
+
+    // same order as the walk, so a snapshot can be read sequentially
+    DiffEntry e;
+    while (source.next(e)) {
+        s << (quint8)e.kind;
+        if (e.kind != DiffEntry::End) {
+            s << e.name << e.size;
+        }
+        if (e.kind == DiffEntry::Dir) {
+            source.descend(true);
+        }
+    }
+
+    return (s.status() == QDataStream::Ok);
+}
+
+
+// ScanDiff
+
+ScanDiff::ScanDiff(DiffSource *oldTree, DiffSource *newTree)
+{
+    _old = oldTree;
+    _new = newTree;
+}
+
+bool ScanDiff::run(DiffListener *l)
+{
+    l->enterDir(_new->topPath());
+    if (!diffDir(l)) {
+        return false;
+    }
+    l->leaveDir(_old->topSize(), _new->topSize());
+    return true;
+}
+
+/* Merge the entries of the current directory of both trees */
+bool ScanDiff::diffDir(DiffListener *l)
+{
+    DiffEntry o, n;
+    if (!_old->next(o) || !_new->next(n)) {
+        return false;
+    }
+
+    while ((o.kind != DiffEntry::End) || (n.kind != DiffEntry::End)) {
+        int c = compareEntries(o, n);
+        if (c < 0) {
+            l->changed(o.name, o.kind == DiffEntry::Dir,
+                       DiffListener::Removed, o.size, 0);
+            if (o.kind == DiffEntry::Dir) {
+                _old->descend(false);
+            }
+            if (!_old->next(o)) {
+                return false;
+            }
+            continue;
+        }
+        if (c > 0) {
+            l->changed(n.name, n.kind == DiffEntry::Dir,
+                       DiffListener::Added, 0, n.size);
+            if (n.kind == DiffEntry::Dir) {
+                _new->descend(false);
+            }
+            if (!_new->next(n)) {
+                return false;
+            }
+            continue;
+        }
+
+        if (o.kind == DiffEntry::File) {
+            if (o.size != n.size) {
+                l->changed(n.name, false,
+                           (n.size > o.size) ? DiffListener::Grown : DiffListener::Shrunk,
+                           o.size, n.size);
+            }
+        } else {
+            l->enterDir(n.name);
+            _old->descend(true);
+            _new->descend(true);
+            if (!diffDir(l)) {
+                return false;
+            }
+            l->leaveDir(o.size, n.size);
+        }
+
+        if (!_old->next(o) || !_new->next(n)) {
+            return false;
+        }
+    }
+
+    return true;
+}
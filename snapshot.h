@@ -0,0 +1,155 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Snapshots of scan trees, and the difference of two trees
+ */
+
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+class ScanDir;
+
+/* One entry of a tree walk */
+struct DiffEntry {
+    enum Kind { File, Dir, End };
+
+    Kind kind;
+    QString name;
+    qint64 size;
+};
+
+/**
+ * A tree, walked in pre-order without keeping it in memory.
+ *
+ * Entries of a directory come as files, then directories, each
+ * sorted by name, followed by an End entry. After a Dir entry,
+ * descend() has to be called before the next entry: to get the
+ * contents of that directory, or to skip them.
+ * The walk starts inside of the top directory.
+ */
+class DiffSource
+{
+public:
+    virtual ~DiffSource() {}
+
+    virtual QString topPath() const = 0;
+    virtual qint64 topSize() const = 0;
+    // returns false at the end of the tree or on errors
+    virtual bool next(DiffEntry &) = 0;
+    virtual void descend(bool enter) = 0;
+};
+
+/* Walk of a ScanDir tree of a finished scan */
+class ScanDirSource: public DiffSource
+{
+public:
+    explicit ScanDirSource(ScanDir *top);
+
+    QString topPath() const Q_DECL_OVERRIDE;
+    qint64 topSize() const Q_DECL_OVERRIDE;
+    bool next(DiffEntry &) Q_DECL_OVERRIDE;
+    void descend(bool enter) Q_DECL_OVERRIDE;
+
+private:
+    struct Frame {
+        ScanDir *dir;
+        QVector<int> files, dirs;
+        int pos;
+    };
+    void push(ScanDir *);
+
+    ScanDir *_top;
+    QVector<Frame> _stack;
+    ScanDir *_lastDir;
+};
+
+/* Walk of a snapshot file written by ScanSnapshot::save() */
+class SnapshotSource: public DiffSource
+{
+public:
+    explicit SnapshotSource(const QString &file);
+
+    bool isValid() const
+    {
+        return _valid;
+    }
+
+    QString topPath() const Q_DECL_OVERRIDE;
+    qint64 topSize() const Q_DECL_OVERRIDE;
+    bool next(DiffEntry &) Q_DECL_OVERRIDE;
+    void descend(bool enter) Q_DECL_OVERRIDE;
+
+private:
+    QFile _file;
+    QDataStream _stream;
+    bool _valid;
+    QString _topPath;
+    qint64 _topSize;
+};
+
+namespace ScanSnapshot
+{
+// write the tree of a finished scan to <file>; all files must be kept
+bool save(ScanDir *top, const QString &file);
+}
+
+/**
+ * Receives the differences found by ScanDiff::run().
+ *
+ * Directories present on both sides are reported by enterDir() and
+ * leaveDir() around their changes; added and removed directories
+ * are reported as a whole, without their contents.
+ */
+class DiffListener
+{
+public:
+    enum Change { Added, Removed, Grown, Shrunk };
+
+    virtual ~DiffListener() {}
+    virtual void enterDir(const QString &name) = 0;
+    virtual void leaveDir(qint64 oldSize, qint64 newSize) = 0;
+    virtual void changed(const QString &name, bool isDir, Change,
+                         qint64 oldSize, qint64 newSize) = 0;
+};
+
+/**
+ * Difference of two trees, by merging the walks of both.
+ *
+ * For each tree, only the entries of the directories along the
+ * current path are kept in memory, one level per depth (none for
+ * snapshots), so huge trees can be compared.
+ */
+class ScanDiff
+{
+public:
+    ScanDiff(DiffSource *oldTree, DiffSource *newTree);
+
+    bool run(DiffListener *);
+
+private:
+    bool diffDir(DiffListener *);
+
+    DiffSource *_old, *_new;
+};
+
+#endif // SNAPSHOT_H
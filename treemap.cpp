@@ -22,10 +22,15 @@
  */
 
 #include "treemap.h"
+#include "treemaplayout.h"
+#include "profiler.h"
 
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 
 #include <QApplication>
+#include <QCache>
 #include <QDebug>
 #include <QPainter>
 #include <QRegExp>
@@ -39,10 +44,15 @@
 #include <QToolTip>
 #include <QStylePainter>
 #include <QStyleOptionFocusRect>
+#include <QTimer>
 
 // set this to 1 to enable debug output
 #define DEBUG_DRAWING 0
 #define MAX_FIELD 12
+// number of cached text layouts (widths, line breaks, elided texts)
+#define TEXT_LAYOUT_CACHE_SIZE 20000
+// depth levels drawn per frame with progressive drawing
+#define PROGRESSIVE_DEPTH 2
 
 //
 // StoredDrawParams
@@ -137,6 +147,16 @@ void StoredDrawParams::ensureField(int f)
     }
 }
 
+qint64 StoredDrawParams::fieldMemory() const
+{
+    // pixmaps are shared with the icon cache and not counted
+    qint64 m = _field.capacity() * (qint64)sizeof(Field);
+    foreach (const Field &f, _field) {
+        m += f.text.capacity() * (qint64)sizeof(QChar);
+    }
+    return m;
+}
+
 void StoredDrawParams::setField(int f, const QString &t, const QPixmap &pm,
                                 Position p, int maxLines)
 {
@@ -204,7 +224,7 @@ RectDrawing::RectDrawing(const QRect &r)
 
 RectDrawing::~RectDrawing()
 {
-    delete _fm;
+    // _fm is shared via the text layout cache
     delete _dp;
 }
 
@@ -369,13 +389,127 @@ void RectDrawing::drawBack(QPainter *p, DrawParams *dp)
     p->fillRect(r, normal);
 }
 
+//
+// Text layout cache
+//
+// Labels are drawn again and again with the same font and available
+// width. Getting text widths and line breaks from QFontMetrics needs
+// text shaping, so results are cached and labels only get shaped once.
+//
+
+enum TextLayoutMode { LayoutWidth, LayoutBreak, LayoutBreakBackwards, LayoutElided };
+
+struct TextLayoutKey {
+    QString text;
+    QString font; // QFont::key()
+    int maxWidth;
+    int mode;
+
+    bool operator==(const TextLayoutKey &k) const
+    {
+        return (maxWidth == k.maxWidth) && (mode == k.mode) &&
+               (text == k.text) && (font == k.font);
+    }
+};
+
+inline uint qHash(const TextLayoutKey &k)
+{
+    return qHash(k.text) ^ qHash(k.font) ^ (uint)(k.maxWidth * 4 + k.mode);
+}
+
+struct TextLayout {
+    int breakPos;
+    int width;
+    QString elided;
+};
+
+static QCache<TextLayoutKey, TextLayout> *textLayoutCache()
+{
+    static QCache<TextLayoutKey, TextLayout> *c = 0;
+    if (!c) {
+        c = new QCache<TextLayoutKey, TextLayout>(TEXT_LAYOUT_CACHE_SIZE);
+    }
+
+    return c;
+}
+
+/* Returns font metrics for a font, shared by all RectDrawing objects.
+ * Also sets <key> to the key of the font, used for the layout cache.
+ */
+static QFontMetrics *cachedFontMetrics(const QFont &font, QString &key)
+{
+    static QFont *lastFont = 0;
+    static QString *lastKey = 0;
+    static QFontMetrics *lastFm = 0;
+    static QHash<QString, QFontMetrics *> *metrics = 0;
+
+    // fast path: usually, all items use the widget font
+    if (lastFont && (*lastFont == font)) {
+        key = *lastKey;
+        return lastFm;
+    }
+
+    if (!metrics) {
+        metrics = new QHash<QString, QFontMetrics *>;
+        lastFont = new QFont;
+        lastKey = new QString;
+    }
+
+    key = font.key();
+    QFontMetrics *fm = metrics->value(key);
+    if (!fm) {
+        fm = new QFontMetrics(font);
+        metrics->insert(key, fm);
+    }
+
+    *lastFont = font;
+    *lastKey = key;
+    lastFm = fm;
+    return fm;
+}
+
+static int cachedWidth(QFontMetrics *fm, const QString &fontKey,
+                       const QString &text)
+{
+    TextLayoutKey k = { text, fontKey, 0, LayoutWidth };
+    TextLayout *l = textLayoutCache()->object(k);
+    if (l) {
+        return l->width;
+    }
+
+    l = new TextLayout;
+    l->breakPos = text.length();
+    l->width = fm->width(text);
+    int w = l->width;
+    textLayoutCache()->insert(k, l);
+    return w;
+}
+
+static QString cachedElidedText(QFontMetrics *fm, const QString &fontKey,
+                                const QString &text, int maxWidth)
+{
+    TextLayoutKey k = { text, fontKey, maxWidth, LayoutElided };
+    TextLayout *l = textLayoutCache()->object(k);
+    if (l) {
+        return l->elided;
+    }
+
+    l = new TextLayout;
+    l->elided = fm->elidedText(text, Qt::ElideRight, maxWidth);
+    l->breakPos = l->elided.length();
+    l->width = fm->width(l->elided);
+    QString elided = l->elided;
+    textLayoutCache()->insert(k, l);
+    return elided;
+}
+
 /* Helper for drawField
  * Find a line break position in a string, given a font and maximum width
  *
  * Returns the actually used width, and sets <breakPos>
  */
 static
-int findBreak(int &breakPos, QString text, QFontMetrics *fm, int maxWidth)
+int calcBreak(int &breakPos, const QString &text, QFontMetrics *fm, int maxWidth)
 {
     int usedWidth;
 
@@ -437,23 +571,25 @@ int findBreak(int &breakPos, QString text, QFontMetrics *fm, int maxWidth)
  * Returns the actually used width, and sets <breakPos>
  */
 static
-int findBreakBackwards(int &breakPos, QString text, QFontMetrics *fm, int maxWidth)
+int calcBreakBackwards(int &breakPos, const QString &text, QFontMetrics *fm, int maxWidth)
 {
     int usedWidth;
 
     // does full text fit?
     breakPos = 0;
-    usedWidth = fm->width(text);
+    int fullWidth = fm->width(text);
+    usedWidth = fullWidth;
     if (usedWidth < maxWidth) {
         return usedWidth;
     }
 
     // now raise breakPos until best position is found.
-    // first by binary search, resulting in a position a little bit too small
+    // first by binary search, resulting in a position a little bit too small.
+    // The tail width is the full width minus the head, without a copy
     int topPos = text.length();
     while (qAbs(maxWidth - usedWidth) > 3 * fm->maxWidth()) {
         int halfPos = (breakPos + topPos) / 2;
-        int halfWidth = fm->width(text.mid(halfPos));
+        int halfWidth = fullWidth - fm->width(text, halfPos);
         if (halfWidth < maxWidth) {
             breakPos = halfPos;
             usedWidth = halfWidth;
@@ -484,7 +620,7 @@ int findBreakBackwards(int &breakPos, QString text, QFontMetrics *fm, int maxWid
         lastCat = cat;
 
         breakPos = pos;
-        usedWidth = fm->width(text.mid(breakPos));
+        usedWidth = fullWidth - fm->width(text, breakPos);
         if (usedWidth < maxWidth) {
             break;
         }
@@ -492,6 +628,35 @@ int findBreakBackwards(int &breakPos, QString text, QFontMetrics *fm, int maxWid
     return usedWidth;
 }
 
+/* Cached versions of calcBreak()/calcBreakBackwards()
+ * Labels are drawn into the shadow buffer when their item is laid out,
+ * so this runs once per layout; redraws of unchanged items hit the cache.
+ */
+static
+int findBreak(int &breakPos, const QString &text, QFontMetrics *fm,
+              const QString &fontKey, int maxWidth, bool backwards)
+{
+    TextLayoutKey k = { text, fontKey, maxWidth,
+                        backwards ? LayoutBreakBackwards : LayoutBreak
+                      };
+    TextLayout *l = textLayoutCache()->object(k);
+    if (l) {
+        breakPos = l->breakPos;
+        return l->width;
+    }
+
+    l = new TextLayout;
+    if (backwards) {
+        l->width = calcBreakBackwards(l->breakPos, text, fm, maxWidth);
+    } else {
+        l->width = calcBreak(l->breakPos, text, fm, maxWidth);
+    }
+    breakPos = l->breakPos;
+    int w = l->width;
+    textLayoutCache()->insert(k, l);
+    return w;
+}
+
 bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
 {
     if (!dp) {
@@ -499,7 +664,7 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
     }
 
     if (!_fm) {
-        _fm = new QFontMetrics(dp->font());
+        _fm = cachedFontMetrics(dp->font(), _fontKey);
         _fontHeight = _fm->height();
     }
 
@@ -652,10 +817,7 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
     }
 
     // stop as soon as possible when there is no space for "..."
-    static int dotW = 0;
-    if (!dotW) {
-        dotW = _fm->width(QStringLiteral("..."));
-    }
+    int dotW = cachedWidth(_fm, _fontKey, QStringLiteral("..."));
     if (width < dotW) {
         return false;
     }
@@ -684,7 +846,7 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
     }
 
     // width of text and pixmap to be drawn
-    int w = pixW + _fm->width(name);
+    int w = pixW + cachedWidth(_fm, _fontKey, name);
 
     if (0) qDebug() << "  For '" << name << "': Unused " << unused
                              << ", StrW " << w << ", Width " << width << endl;
@@ -741,7 +903,8 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
             int breakPos;
 
             if (!isBottom) {
-                w = pixW + findBreak(breakPos, name, _fm, width - pixW);
+                w = pixW + findBreak(breakPos, name, _fm, _fontKey,
+                                     width - pixW, false);
 
                 remaining = name.mid(breakPos);
                 // remove space on break point
@@ -751,7 +914,8 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
                     name = name.left(breakPos);
                 }
             } else { // bottom
-                w = pixW + findBreakBackwards(breakPos, name, _fm, width - pixW);
+                w = pixW + findBreak(breakPos, name, _fm, _fontKey,
+                                     width - pixW, true);
 
                 remaining = name.left(breakPos);
                 // remove space on break point
@@ -767,8 +931,8 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
 
         /* truncate and add ... if needed */
         if (w > width) {
-            name = _fm->elidedText(name, Qt::ElideRight, width - pixW);
-            w = _fm->width(name) + pixW;
+            name = cachedElidedText(_fm, _fontKey, name, width - pixW);
+            w = cachedWidth(_fm, _fontKey, name) + pixW;
         }
 
         int x = 0;
@@ -804,7 +968,7 @@ bool RectDrawing::drawField(QPainter *p, int f, DrawParams *dp)
             break;
         }
         name = remaining;
-        w = pixW + _fm->width(name);
+        w = pixW + cachedWidth(_fm, _fontKey, name);
     }
 
     // make sure the pix stays visible
@@ -872,31 +1036,256 @@ TreeMapItem *TreeMapItemList::commonParent()
     return parent;
 }
 
-class TreeMapItemLessThan
+
+//
+// TreeMapSelection
+//
+
+const TreeMapItemList &TreeMapSelection::list() const
+{
+    if (_removed > 0) {
+        TreeMapItemList l;
+        l.reserve(_index.count());
+        foreach (TreeMapItem *i, _list)
+            if (i) {
+                _index[i] = l.count();
+                l.append(i);
+            }
+        _list = l;
+        _removed = 0;
+    }
+    return _list;
+}
+
+void TreeMapSelection::append(TreeMapItem *i)
+{
+    if (_index.contains(i)) {
+        return;
+    }
+    if (_removed > _index.count()) {
+        list();
+    }
+    _index.insert(i, _list.count());
+    _list.append(i);
+
+    for (TreeMapItem *p = i->parent(); p; p = p->parent()) {
+        _below[p]++;
+    }
+}
+
+// parents still exist: items are deleted from child to parent
+void TreeMapSelection::remove(TreeMapItem *i)
+{
+    QHash<TreeMapItem *, int>::iterator it = _index.find(i);
+    if (it == _index.end()) {
+        return;
+    }
+    _list[*it] = 0;
+    _index.erase(it);
+    _removed++;
+
+    for (TreeMapItem *p = i->parent(); p; p = p->parent()) {
+        QHash<TreeMapItem *, int>::iterator b = _below.find(p);
+        if ((b != _below.end()) && (--(*b) == 0)) {
+            _below.erase(b);
+        }
+    }
+}
+
+void TreeMapSelection::clear()
+{
+    _index.clear();
+    _list.clear();
+    _removed = 0;
+    _below.clear();
+}
+
+
+//
+// Sorting helpers
+//
+
+/* Unsigned integer with the same order as the double value */
+static inline quint64 radixKey(double v)
+{
+    quint64 k;
+    memcpy(&k, &v, sizeof(k));
+    if (k & Q_UINT64_C(0x8000000000000000)) {
+        return ~k;
+    }
+    return k | Q_UINT64_C(0x8000000000000000);
+}
+
+struct RadixEntry {
+    quint64 key;
+    int index;
+};
+
+class RadixEntryLessThan
 {
 public:
-    bool operator()(const TreeMapItem *i1, const TreeMapItem *i2) const
+    bool operator()(const RadixEntry &e1, const RadixEntry &e2) const
     {
-        TreeMapItem *p = i1->parent();
-        // should not happen
-        if (!p) {
-            return false;
-        }
+        return e1.key < e2.key;
+    }
+};
 
-        bool ascending;
-        bool result;
-        int textNo = p->sorting(&ascending);
-        if (textNo < 0) {
-            result = i1->value() < i2->value();
-        } else {
-            result = i1->text(textNo) < i2->text(textNo);
+/* Sets <order> to the indexes of <values> in ascending order.
+ * Stable. Large arrays use a LSD radix sort with 8 bits per pass. */
+static void sortByValue(QVector<int> &order, const QVector<double> &values)
+{
+    int n = values.size();
+    QVector<RadixEntry> e(n);
+    for (int i = 0; i < n; i++) {
+        e[i].key = radixKey(values[i]);
+        e[i].index = i;
+    }
+
+    if (n < 64) {
+        std::stable_sort(e.begin(), e.end(), RadixEntryLessThan());
+    } else {
+        QVector<RadixEntry> tmp(n);
+        RadixEntry *from = e.data(), *to = tmp.data();
+        for (int shift = 0; shift < 64; shift += 8) {
+            int count[257];
+            memset(count, 0, sizeof(count));
+            for (int i = 0; i < n; i++) {
+                count[((from[i].key >> shift) & 0xff) + 1]++;
+            }
+            // all keys equal in this byte: nothing to do
+            if (count[((from[0].key >> shift) & 0xff) + 1] == n) {
+                continue;
+            }
+            for (int b = 1; b < 257; b++) {
+                count[b] += count[b - 1];
+            }
+            for (int i = 0; i < n; i++) {
+                to[count[(from[i].key >> shift) & 0xff]++] = from[i];
+            }
+            qSwap(from, to);
         }
+        if (from != e.data()) {
+            memcpy(e.data(), from, n * sizeof(RadixEntry));
+        }
+    }
+
+    order.resize(n);
+    for (int i = 0; i < n; i++) {
+        order[i] = e[i].index;
+    }
+}
 
-        return ascending ? result : !result;
+class TextKeyLessThan
+{
+public:
+    TextKeyLessThan(const QVector<QString> &k, bool ascending)
+        : _k(k), _ascending(ascending) {}
+    bool operator()(int i1, int i2) const
+    {
+        return _ascending ? (_k[i1] < _k[i2]) : (_k[i2] < _k[i1]);
     }
+
+private:
+    const QVector<QString> &_k;
+    bool _ascending;
 };
 
-TreeMapItemLessThan treeMapItemLessThan;
+
+//
+// TreeMapLeafArray
+//
+
+void TreeMapLeafArray::reserve(int n)
+{
+    _value.reserve(n);
+    _nameIndex.reserve(n);
+    _rect.reserve(n);
+    _flags.reserve(n);
+}
+
+void TreeMapLeafArray::append(double value, int nameIndex)
+{
+    _value.append(value);
+    _nameIndex.append(nameIndex);
+    _rect.append(QRect());
+    _flags.append(0);
+}
+
+void TreeMapLeafArray::sort()
+{
+    int n = _value.size();
+    QVector<int> order;
+    sortByValue(order, _value);
+
+    QVector<double> value(n);
+    QVector<int> nameIndex(n);
+    QVector<uchar> flags(n);
+    for (int l = 0; l < n; l++) {
+        value[l] = _value[order[l]];
+        nameIndex[l] = _nameIndex[order[l]];
+        flags[l] = _flags[order[l]];
+    }
+    _value = value;
+    _nameIndex = nameIndex;
+    _flags = flags;
+    clearRects();
+}
+
+void TreeMapLeafArray::clearRects()
+{
+    for (int l = 0; l < _rect.size(); l++) {
+        _rect[l] = QRect();
+    }
+    _order.clear();
+    _reach.clear();
+}
+
+qint64 TreeMapLeafArray::memoryUsage() const
+{
+    return _value.capacity() * (qint64)sizeof(double)
+           + _nameIndex.capacity() * (qint64)sizeof(int)
+           + _rect.capacity() * (qint64)sizeof(QRect)
+           + _flags.capacity() * (qint64)sizeof(uchar)
+           + _order.capacity() * (qint64)sizeof(int)
+           + _reach.capacity() * (qint64)sizeof(QRect);
+}
+
+void TreeMapLeafArray::setLayoutOrder(const QVector<int> &order)
+{
+    _order = order;
+    _reach.resize(order.count());
+    QRect r;
+    for (int k = order.count() - 1; k >= 0; k--) {
+        r |= _rect[order[k]];
+        _reach[k] = r;
+    }
+}
+
+/* The bounding rectangles of the leaves laid out from k on shrink
+ * with k. When each rectangle is split off the rest, the last one
+ * still containing <p> belongs to the hit leaf. Bisection, Columns
+ * and Rows do not split like this: earlier leaves are checked, too.
+ */
+int TreeMapLeafArray::leafAt(const QPoint &p) const
+{
+    int lo = 0, hi = _order.count();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (_reach[mid].contains(p)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (int k = lo - 1; k >= 0; k--) {
+        int l = _order[k];
+        if (!isMaterialized(l) && _rect[l].contains(p)) {
+            return l;
+        }
+    }
+    return -1;
+}
 
 // TreeMapItem
 
@@ -907,10 +1296,13 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value)
 
     _sum = 0;
     _children = 0;
+    _leaves = 0;
     _widget = 0;
     _index = -1;
-    _depth = -1; // not set
-    _unused_self = 0;
+    _depth = _parent ? _parent->_depth + 1 : 1;
+    _drawnValue = 0;
+    _inSelection = false;
+    _inCurrent = false;
 
     if (_parent) {
         // take sorting from parent
@@ -943,10 +1335,13 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value,
 
     _sum = 0;
     _children = 0;
+    _leaves = 0;
     _widget = 0;
     _index = -1;
-    _depth = -1; // not set
-    _unused_self = 0;
+    _depth = _parent ? _parent->_depth + 1 : 1;
+    _drawnValue = 0;
+    _inSelection = false;
+    _inCurrent = false;
 
     if (_parent) {
         _parent->addItem(this);
@@ -955,11 +1350,8 @@ TreeMapItem::TreeMapItem(TreeMapItem *parent, double value,
 
 TreeMapItem::~TreeMapItem()
 {
-    if (_children) {
-        qDeleteAll(*_children);
-        delete _children;
-        _children = 0;
-    }
+    deleteChildren();
+    delete _leaves;
 
     // finally, notify widget about deletion
     if (_widget) {
@@ -973,6 +1365,22 @@ void TreeMapItem::setParent(TreeMapItem *p)
     if (p) {
         _widget = p->_widget;
     }
+    setDepth(p ? p->_depth + 1 : 1);
+}
+
+// depth is kept up to date on insertion, for all items below
+void TreeMapItem::setDepth(int d)
+{
+    if (_depth == d) {
+        return;
+    }
+
+    _depth = d;
+    if (_children) {
+        foreach (TreeMapItem *i, *_children) {
+            i->setDepth(d + 1);
+        }
+    }
 }
 
 bool TreeMapItem::isChildOf(TreeMapItem *item)
@@ -1014,9 +1422,28 @@ void TreeMapItem::clear()
             _widget->clearSelection(this);
         }
 
-        qDeleteAll(*_children);
-        delete _children;
-        _children = 0;
+        deleteChildren();
+    }
+
+    delete _leaves;
+    _leaves = 0;
+}
+
+void TreeMapItem::deleteChildren()
+{
+    if (!_children) {
+        return;
+    }
+
+    // the widget forgets about the whole subtree at once
+    bool bulk = _widget && _widget->deletingChildren(this);
+
+    qDeleteAll(*_children);
+    delete _children;
+    _children = 0;
+
+    if (bulk) {
+        _widget->deletedChildren();
     }
 }
 
@@ -1043,18 +1470,6 @@ QStringList TreeMapItem::path(int textNo) const
     return list;
 }
 
-int TreeMapItem::depth() const
-{
-    if (_depth > 0) {
-        return _depth;
-    }
-
-    if (_parent) {
-        return _parent->depth() + 1;
-    }
-    return 1;
-}
-
 bool TreeMapItem::initialized()
 {
     if (!_children) {
@@ -1077,9 +1492,57 @@ void TreeMapItem::addItem(TreeMapItem *i)
     i->setParent(this);
 
     _children->append(i); // preserve insertion order
-    if (sorting(0) != -1) {
-        qSort(_children->begin(), _children->end(), treeMapItemLessThan);
+    sortChildren();
+}
+
+/* The sort key of every child is taken only once: value() and text()
+ * may be expensive in subclasses. */
+void TreeMapItem::sortChildren()
+{
+    bool ascending;
+    int textNo = sorting(&ascending);
+    if (!_children || (textNo == -1) || (_children->count() < 2)) {
+        return;
+    }
+
+    int n = _children->count();
+    QVector<int> order;
+    if (textNo < 0) {
+        QVector<double> keys(n);
+        for (int i = 0; i < n; i++) {
+            double v = _children->at(i)->value();
+            keys[i] = ascending ? v : -v;
+        }
+        sortByValue(order, keys);
+    } else {
+        QVector<QString> keys(n);
+        order.resize(n);
+        for (int i = 0; i < n; i++) {
+            keys[i] = _children->at(i)->text(textNo);
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         TextKeyLessThan(keys, ascending));
+    }
+
+    // nothing to do if already in order
+    bool sorted = true;
+    for (int i = 0; i < n; i++) {
+        if (order[i] != i) {
+            sorted = false;
+            break;
+        }
+    }
+    if (sorted) {
+        return;
     }
+
+    TreeMapItemList sortedList;
+    sortedList.reserve(n);
+    for (int i = 0; i < n; i++) {
+        sortedList.append(_children->at(order[i]));
+    }
+    *_children = sortedList;
 }
 
 // default implementations of virtual functions
@@ -1148,9 +1611,7 @@ void TreeMapItem::setSorting(int textNo, bool ascending)
     _sortAscending = ascending;
     _sortTextNo = textNo;
 
-    if (_children && _sortTextNo != -1) {
-        qSort(_children->begin(), _children->end(), treeMapItemLessThan);
-    }
+    sortChildren();
 }
 
 void TreeMapItem::resort(bool recursive)
@@ -1159,9 +1620,9 @@ void TreeMapItem::resort(bool recursive)
         return;
     }
 
-    if (_sortTextNo != -1) {
-        qSort(_children->begin(), _children->end(), treeMapItemLessThan);
-    }
+    PROFILE_SCOPE("TreeMapItem::resort");
+
+    sortChildren();
 
     if (recursive)
         foreach (TreeMapItem *i, *_children) {
@@ -1192,6 +1653,38 @@ TreeMapItemList *TreeMapItem::children()
     return _children;
 }
 
+QString TreeMapItem::leafText(int, int) const
+{
+    return QString();
+}
+
+QColor TreeMapItem::leafBackColor(int) const
+{
+    return backColor();
+}
+
+TreeMapItem *TreeMapItem::materializeLeaf(int)
+{
+    return 0;
+}
+
+qint64 TreeMapItem::memoryUsage() const
+{
+    qint64 m = sizeof(TreeMapItem) + fieldMemory();
+    // QList allocates each QRect separately
+    m += _freeRects.count() * (qint64)(sizeof(void *) + sizeof(QRect));
+    if (_leaves) {
+        m += sizeof(TreeMapLeafArray) + _leaves->memoryUsage();
+    }
+    if (_children) {
+        m += sizeof(TreeMapItemList) + _children->count() * (qint64)sizeof(void *);
+        foreach (TreeMapItem *i, *_children) {
+            m += i->memoryUsage();
+        }
+    }
+    return m;
+}
+
 void TreeMapItem::clearItemRect()
 {
     _rect = QRect();
@@ -1267,6 +1760,7 @@ TreeMapWidget::TreeMapWidget(TreeMapItem *base,
     _allowRotation = true;
     _borderWidth = 2;
     _shading = true; // beautiful is default!
+    _background = true;
     _maxSelectDepth = -1; // unlimited
     _maxDrawingDepth = -1; // unlimited
     _minimalArea = -1; // unlimited
@@ -1286,8 +1780,19 @@ TreeMapWidget::TreeMapWidget(TreeMapItem *base,
     _oldCurrent = 0;
     _pressed = 0;
     _lastOver = 0;
+    _deletingBelow = 0;
     _needsRefresh = _base;
 
+    _progressive = false;
+    _lodActive = false;
+    _drawingBudget = 40;
+    _lodDepth = PROGRESSIVE_DEPTH;
+    _lodStopDepth = -1;
+    _lodTimer = new QTimer(this);
+    _lodTimer->setSingleShot(true);
+    connect(_lodTimer, SIGNAL(timeout()),
+            this, SLOT(refineDrawing()));
+
     setAttribute(Qt::WA_NoSystemBackground, true);
     setFocusPolicy(Qt::StrongFocus);
 }
@@ -1372,6 +1877,16 @@ void TreeMapWidget::setShadingEnabled(bool s)
     redraw();
 }
 
+void TreeMapWidget::setBackgroundEnabled(bool b)
+{
+    if (_background == b) {
+        return;
+    }
+
+    _background = b;
+    redraw();
+}
+
 void TreeMapWidget::drawFrame(int d, bool b)
 {
     if ((d < 0) || (d >= 4) || (_drawFrame[d] == b)) {
@@ -1663,11 +2178,41 @@ void TreeMapWidget::setMinimalArea(int area)
     redraw();
 }
 
+void TreeMapWidget::setProgressiveDrawing(bool enable)
+{
+    if (_progressive == enable) {
+        return;
+    }
+
+    _progressive = enable;
+    restartProgressiveDrawing();
+    redraw();
+}
+
+void TreeMapWidget::setDrawingBudget(int ms)
+{
+    _drawingBudget = ms;
+}
+
+void TreeMapWidget::restartProgressiveDrawing()
+{
+    _lodTimer->stop();
+    _lodPending.clear();
+    _lodDepth = PROGRESSIVE_DEPTH;
+}
+
 void TreeMapWidget::deletingItem(TreeMapItem *i)
 {
+    // references were removed for all children in deletingChildren()
+    if (_deletingBelow) {
+        return;
+    }
+
     // remove any references to the item to be deleted
-    _selection.removeAll(i);
-    _tmpSelection.removeAll(i);
+    _selection.remove(i);
+    _tmpSelection.remove(i);
+    _lodPending.removeAll(i);
+    _damaged.removeAll(i);
 
     if (_current == i) {
         _current = 0;
@@ -1690,15 +2235,86 @@ void TreeMapWidget::deletingItem(TreeMapItem *i)
     }
 }
 
-QString TreeMapWidget::tipString(TreeMapItem *i) const
+/* Is <i> a child of <parent>, not <parent> itself? */
+static bool below(TreeMapItem *i, TreeMapItem *parent)
 {
-    QString tip, itemTip;
+    return i && (i != parent) && i->isChildOf(parent);
+}
 
-    while (i) {
-        if (!i->text(0).isEmpty()) {
-            itemTip = i->text(0);
-            if (!i->text(1).isEmpty()) {
-                itemTip += " (" + i->text(1) + ')';
+static void removeChildren(TreeMapSelection &s, TreeMapItem *parent)
+{
+    if (s.count() == 0) {
+        return;
+    }
+
+    TreeMapSelection kept;
+    foreach (TreeMapItem *i, s.list())
+        if (!below(i, parent)) {
+            kept.append(i);
+        }
+    s = kept;
+}
+
+static void removeChildren(TreeMapItemList &l, TreeMapItem *parent)
+{
+    if (l.isEmpty()) {
+        return;
+    }
+
+    TreeMapItemList kept;
+    foreach (TreeMapItem *i, l)
+        if (!below(i, parent)) {
+            kept.append(i);
+        }
+    l = kept;
+}
+
+bool TreeMapWidget::deletingChildren(TreeMapItem *parent)
+{
+    if (_deletingBelow) {
+        return false;
+    }
+    _deletingBelow = parent;
+
+    // remove any references to items below <parent>
+    removeChildren(_selection, parent);
+    removeChildren(_tmpSelection, parent);
+    removeChildren(_lodPending, parent);
+    removeChildren(_damaged, parent);
+
+    if (below(_current, parent)) {
+        _current = 0;
+    }
+    if (below(_oldCurrent, parent)) {
+        _oldCurrent = 0;
+    }
+    if (below(_pressed, parent)) {
+        _pressed = 0;
+    }
+    if (below(_lastOver, parent)) {
+        _lastOver = 0;
+    }
+    if (below(_needsRefresh, parent)) {
+        _needsRefresh = parent;
+    }
+
+    return true;
+}
+
+void TreeMapWidget::deletedChildren()
+{
+    _deletingBelow = 0;
+}
+
+QString TreeMapWidget::tipString(TreeMapItem *i) const
+{
+    QString tip, itemTip;
+
+    while (i) {
+        if (!i->text(0).isEmpty()) {
+            itemTip = i->text(0);
+            if (!i->text(1).isEmpty()) {
+                itemTip += " (" + i->text(1) + ')';
             }
 
             if (!tip.isEmpty()) {
@@ -1753,6 +2369,18 @@ TreeMapItem *TreeMapWidget::item(int x, int y) const
             }
         }
 
+        // a compact leaf gets a full item as soon as it is hit
+        TreeMapLeafArray *leaves = p->leaves();
+        int l = (!i && leaves) ? leaves->leafAt(QPoint(x, y)) : -1;
+        if (l >= 0) {
+            i = p->materializeLeaf(l);
+            if (i) {
+                leaves->setMaterialized(l);
+                i->setItemRect(leaves->rect(l));
+                i->addFreeRect(leaves->rect(l));
+            }
+        }
+
         if (!i) {
             static TreeMapItem *last = 0;
             if (p != last) {
@@ -1848,17 +2476,17 @@ void TreeMapWidget::setMarked(int markNo, bool redrawWidget)
 }
 
 /* Returns all items which appear only in one of the given lists */
-TreeMapItemList TreeMapWidget::diff(TreeMapItemList &l1,
-                                    TreeMapItemList &l2)
+TreeMapItemList TreeMapWidget::diff(const TreeMapSelection &l1,
+                                    const TreeMapSelection &l2)
 {
     TreeMapItemList l;
 
-    foreach (TreeMapItem *i, l1)
+    foreach (TreeMapItem *i, l1.list())
         if (!l2.contains(i)) {
             l.append(i);
         }
 
-    foreach (TreeMapItem *i, l2)
+    foreach (TreeMapItem *i, l2.list())
         if (!l1.contains(i)) {
             l.append(i);
         }
@@ -1879,9 +2507,17 @@ TreeMapItem *TreeMapWidget::setTmpSelected(TreeMapItem *item, bool selected)
         return 0;
     }
 
-    TreeMapItemList old = _tmpSelection;
+    // items added or removed, without copying the selection
+    TreeMapItemList changed;
 
     if (_selectionMode == Single) {
+        foreach (TreeMapItem *i, _tmpSelection.list())
+            if (!selected || (i != item)) {
+                changed.append(i);
+            }
+        if (selected && !_tmpSelection.contains(item)) {
+            changed.append(item);
+        }
         _tmpSelection.clear();
         if (selected) {
             _tmpSelection.append(item);
@@ -1889,28 +2525,41 @@ TreeMapItem *TreeMapWidget::setTmpSelected(TreeMapItem *item, bool selected)
     } else {
         if (selected) {
             // first remove any selection which is parent or child of <item>
-            foreach (TreeMapItem *i, _tmpSelection)
-                if (i->isChildOf(item) || item->isChildOf(i)) {
-                    _tmpSelection.removeAll(i);
+            for (TreeMapItem *i = item->parent(); i; i = i->parent()) {
+                if (_tmpSelection.contains(i)) {
+                    _tmpSelection.remove(i);
+                    changed.append(i);
                 }
+            }
+            if (_tmpSelection.containsBelow(item)) {
+                foreach (TreeMapItem *i, _tmpSelection.list())
+                    if (i->isChildOf(item)) {
+                        _tmpSelection.remove(i);
+                        changed.append(i);
+                    }
+            }
 
-            _tmpSelection.append(item);
-        } else {
-            _tmpSelection.removeAll(item);
+            if (!_tmpSelection.contains(item)) {
+                _tmpSelection.append(item);
+                changed.append(item);
+            }
+        } else if (_tmpSelection.contains(item)) {
+            _tmpSelection.remove(item);
+            changed.append(item);
         }
     }
 
-    return diff(old, _tmpSelection).commonParent();
+    return changed.commonParent();
 }
 
 bool TreeMapWidget::clearSelection(TreeMapItem *parent)
 {
-    TreeMapItemList old = _selection;
+    TreeMapSelection old = _selection;
 
     // remove any selection which is child of <parent>
-    foreach (TreeMapItem *i, _selection)
+    foreach (TreeMapItem *i, _selection.list())
         if (i->isChildOf(parent)) {
-            _selection.removeAll(i);
+            _selection.remove(i);
         }
 
     TreeMapItem *changed = diff(old, _selection).commonParent();
@@ -2444,7 +3093,9 @@ void TreeMapWidget::drawTreeMap()
 
     if (_pixmap.size() != size()) {
         _needsRefresh = _base;
+        restartProgressiveDrawing();
     }
+    bool laidOut = _needsRefresh || !_damaged.isEmpty();
 
     if (_needsRefresh) {
 
@@ -2453,6 +3104,9 @@ void TreeMapWidget::drawTreeMap()
         }
 
         if (_needsRefresh == _base) {
+            // everything pending gets drawn again
+            _lodPending.clear();
+
             // redraw whole widget
             _pixmap = QPixmap(size());
             _pixmap.fill(palette().color(backgroundRole()));
@@ -2462,6 +3116,8 @@ void TreeMapWidget::drawTreeMap()
             p.setPen(Qt::black);
             p.drawRect(QRect(2, 2, QWidget::width() - 5, QWidget::height() - 5));
             _base->setItemRect(QRect(3, 3, QWidget::width() - 6, QWidget::height() - 6));
+            // other rectangles get it when laid out in drawItems()
+            _base->setDrawnValue(_base->value());
         } else {
             // only subitem
             if (!_needsRefresh->itemRect().isValid()) {
@@ -2473,8 +3129,48 @@ void TreeMapWidget::drawTreeMap()
         _font = font();
         _fontHeight = fontMetrics().height();
 
+        // with progressive drawing, only go down _lodDepth levels
+        // below base (unlimited after the first full refinement)
+        _lodActive = _progressive;
+        _lodStopDepth = (_lodDepth < 0) ? -1 : _base->depth() + _lodDepth;
+        _lodClock.start();
         drawItems(&p, _needsRefresh);
-        _needsRefresh = 0;
+        _lodActive = false;
+    }
+
+    if (!_damaged.isEmpty()) {
+        QPainter p(&_pixmap);
+
+        _font = font();
+        _fontHeight = fontMetrics().height();
+
+        _lodActive = _progressive;
+        _lodStopDepth = (_lodDepth < 0) ? -1 : _base->depth() + _lodDepth;
+        _lodClock.start();
+        foreach (TreeMapItem *i, _damaged) {
+            // skip if already drawn with a parent
+            if (_needsRefresh && i->isChildOf(_needsRefresh)) {
+                continue;
+            }
+            if (!i->itemRect().isValid()) {
+                continue;
+            }
+
+            if (DEBUG_DRAWING) {
+                qDebug() << "Redrawing damaged " << i->path(0).join(QStringLiteral("/"));
+            }
+
+            drawItems(&p, i);
+        }
+        _lodActive = false;
+        _damaged.clear();
+    }
+    _needsRefresh = 0;
+
+    if (!_lodPending.isEmpty()) {
+        _lodTimer->start(0);
+    } else if (laidOut) {
+        emit layoutFinished();
     }
 
     QStylePainter p(this);
@@ -2489,6 +3185,95 @@ void TreeMapWidget::drawTreeMap()
     }
 }
 
+// Draws children of items postponed by progressive drawing
+// directly into the back buffer, as long as the budget allows
+void TreeMapWidget::refineDrawing()
+{
+    // a pending full redraw will restart the refinement anyway
+    if (_lodPending.isEmpty() || _needsRefresh || _pixmap.isNull()) {
+        return;
+    }
+
+    TreeMapItemList pending = _lodPending;
+    _lodPending.clear();
+
+    // reset cached font object; it could have been changed
+    _font = font();
+    _fontHeight = fontMetrics().height();
+
+    QPainter p(&_pixmap);
+    _lodActive = true;
+    _lodClock.start();
+    int idx = 0;
+    while (idx < pending.size() && _lodClock.elapsed() < _drawingBudget) {
+        TreeMapItem *i = pending.at(idx++);
+        if (!i->itemRect().isValid()) {
+            continue;
+        }
+
+        if (DEBUG_DRAWING) {
+            qDebug() << "Refining " << i->path(0).join(QStringLiteral("/"));
+        }
+
+        _lodStopDepth = i->depth() + PROGRESSIVE_DEPTH;
+        drawItems(&p, i);
+    }
+    _lodActive = false;
+    p.end();
+
+    // not yet refined items go first in the next frame
+    TreeMapItemList rest;
+    while (idx < pending.size()) {
+        rest.append(pending.at(idx++));
+    }
+    rest += _lodPending;
+    _lodPending = rest;
+
+    if (_lodPending.isEmpty()) {
+        // fully refined: next full redraws need no depth limit
+        _lodDepth = -1;
+        emit layoutFinished();
+    } else {
+        _lodTimer->start(0);
+    }
+
+    update();
+}
+
+// returns true if drawing of children of <i> should be postponed
+bool TreeMapWidget::lodStop(TreeMapItem *i)
+{
+    if (!_lodActive) {
+        return false;
+    }
+
+    if ((_lodStopDepth >= 0) && (i->depth() >= _lodStopDepth)) {
+        return true;
+    }
+
+    return _lodClock.elapsed() > _drawingBudget;
+}
+
+void TreeMapWidget::redrawDamaged(TreeMapItem *i)
+{
+    if (!i) {
+        return;
+    }
+
+    // already covered by a pending redraw?
+    if (_needsRefresh && i->isChildOf(_needsRefresh)) {
+        return;
+    }
+    if (!_damaged.contains(i)) {
+        _damaged.append(i);
+    }
+
+    if (isVisible()) {
+        // only the area of the item has to be copied to the screen
+        update(i->itemRect());
+    }
+}
+
 void TreeMapWidget::redraw(TreeMapItem *i)
 {
     if (!i) {
@@ -2512,27 +3297,25 @@ void TreeMapWidget::redraw(TreeMapItem *i)
 void TreeMapWidget::drawItem(QPainter *p,
                              TreeMapItem *item)
 {
-    bool isSelected = false;
+    // parents are always laid out before their children
+    TreeMapItem *parent = item->parent();
+    bool isSelected = parent && parent->inSelection();
+    bool isCurrent = parent && parent->inCurrent();
 
-    if (_markNo > 0) {
-        for (TreeMapItem *i = item; i; i = i->parent()) {
-            if (i->isMarked(_markNo)) {
-                isSelected = true;
-                break;
-            }
-        }
-    } else {
-        foreach (TreeMapItem *i, _tmpSelection) {
-            if (item->isChildOf(i)) {
-                isSelected = true;
-                break;
-            }
+    if (!isSelected) {
+        if (_markNo > 0) {
+            isSelected = item->isMarked(_markNo);
+        } else {
+            isSelected = _tmpSelection.contains(item);
         }
     }
+    if (!isCurrent) {
+        isCurrent = (item == _current);
+    }
+    item->setInSelection(isSelected, isCurrent);
 
-    bool isCurrent = _current && item->isChildOf(_current);
     int dd = item->depth();
-    if (isTransparent(dd)) {
+    if (!_background || isTransparent(dd)) {
         return;
     }
 
@@ -2544,21 +3327,158 @@ void TreeMapWidget::drawItem(QPainter *p,
     d.drawBack(p, item);
 }
 
-bool TreeMapWidget::horizontal(TreeMapItem *i, const QRect &r)
+/* DrawParams for a compact leaf, taken from the owning item */
+class LeafDrawParams: public DrawParams
 {
-    switch (i->splitMode()) {
-    case TreeMapItem::HAlternate:
-        return (i->depth() % 2) == 1;
-    case TreeMapItem::VAlternate:
-        return (i->depth() % 2) == 0;
-    case TreeMapItem::Horizontal:
-        return true;
-    case TreeMapItem::Vertical:
-        return false;
-    default:
-        return r.width() > r.height();
+public:
+    LeafDrawParams(TreeMapItem *parent, int leaf)
+    {
+        _parent = parent;
+        _leaf = leaf;
+        _shaded = true;
+        _rotated = false;
+        _drawFrame = true;
+    }
+
+    QString text(int f) const Q_DECL_OVERRIDE
+    {
+        return _parent->leafText(_leaf, f);
+    }
+    QPixmap pixmap(int) const Q_DECL_OVERRIDE
+    {
+        return QPixmap();
+    }
+    Position position(int f) const Q_DECL_OVERRIDE
+    {
+        return _parent->position(f);
+    }
+    QColor backColor() const Q_DECL_OVERRIDE
+    {
+        return _parent->leafBackColor(_leaf);
+    }
+    const QFont &font() const Q_DECL_OVERRIDE
+    {
+        return _parent->font();
+    }
+    // a leaf is selected/current if its parent is
+    bool selected() const Q_DECL_OVERRIDE
+    {
+        return _parent->selected();
+    }
+    bool current() const Q_DECL_OVERRIDE
+    {
+        return _parent->current();
+    }
+    bool shaded() const Q_DECL_OVERRIDE
+    {
+        return _shaded;
+    }
+    bool rotated() const Q_DECL_OVERRIDE
+    {
+        return _rotated;
+    }
+    bool drawFrame() const Q_DECL_OVERRIDE
+    {
+        return _drawFrame;
+    }
+
+    bool _shaded, _rotated, _drawFrame;
+
+private:
+    TreeMapItem *_parent;
+    int _leaf;
+};
+
+/* Builds the list of children and leaves of <item> in drawing order.
+ * With value sorting, leaves (sorted ascending by value) are merged
+ * into the sorted children, otherwise they are appended.
+ */
+static void layoutList(TreeMapItem *item, TreeMapItemList *children,
+                       TreeMapLayoutList &list)
+{
+    TreeMapLeafArray *leaves = item->leaves();
+    int childCount = children ? children->count() : 0;
+    int leafCount = leaves ? leaves->count() : 0;
+
+    bool ascending;
+    int textNo = item->sorting(&ascending);
+    bool merge = (textNo == -2);
+    if (!merge) {
+        ascending = true;
+    }
+
+    list.reserve(childCount + leafCount);
+    int c = 0, l = 0;
+    while (c < childCount || l < leafCount) {
+        int leaf = ascending ? l : (leafCount - 1 - l);
+        if ((l < leafCount) && leaves->isMaterialized(leaf)) {
+            l++;
+            continue;
+        }
+
+        bool takeLeaf;
+        if (c == childCount) {
+            takeLeaf = true;
+        } else if (l == leafCount) {
+            takeLeaf = false;
+        } else if (!merge) {
+            takeLeaf = false;
+        } else {
+            double lv = leaves->value(leaf);
+            double cv = children->at(c)->value();
+            takeLeaf = ascending ? (lv < cv) : (lv > cv);
+        }
+
+        TreeMapLayoutEntry e;
+        if (takeLeaf) {
+            e.item = 0;
+            e.leaf = leaf;
+            e.value = leaves->value(leaf);
+            l++;
+        } else {
+            e.item = children->at(c);
+            e.leaf = -1;
+            e.value = e.item->value();
+            c++;
+        }
+        list.append(e);
+    }
+}
+
+// draws a compact leaf of <item> like an item without children
+void TreeMapWidget::drawLeaf(QPainter *p, TreeMapItem *item, int leaf)
+{
+    if (isTransparent(item->depth() + 1)) {
+        return;
+    }
+
+    QRect origRect = item->leaves()->rect(leaf);
+    LeafDrawParams dp(item, leaf);
+    dp._shaded = _shading;
+    dp._drawFrame = drawFrame(item->depth() + 1);
+
+    if (_background) {
+        RectDrawing back(origRect);
+        back.drawBack(p, &dp);
+    }
+
+    int bw = item->borderWidth();
+    QRect r = QRect(origRect.x() + bw, origRect.y() + bw,
+                    origRect.width() - 2 * bw, origRect.height() - 2 * bw);
+
+    // if we have space for text...
+    if ((r.height() < _fontHeight) || (r.width() < _fontHeight)) {
+        return;
+    }
+
+    RectDrawing d(r);
+    dp._rotated = _allowRotation && (r.height() > r.width());
+    for (int no = 0; no < _attr.size(); no++) {
+        if (!fieldVisible(no)) {
+            continue;
+        }
+        d.drawField(p, no, &dp);
     }
-    return false;
 }
 
 /**
@@ -2567,6 +3487,8 @@ bool TreeMapWidget::horizontal(TreeMapItem *i, const QRect &r)
 void TreeMapWidget::drawItems(QPainter *p,
                               TreeMapItem *item)
 {
+    PROFILE_SCOPE("TreeMapWidget::drawItems");
+
     if (DEBUG_DRAWING)
         qDebug() << "+drawItems(" << item->path(0).join(QStringLiteral("/")) << ", "
                       << item->itemRect().x() << "/" << item->itemRect().y()
@@ -2582,12 +3504,14 @@ void TreeMapWidget::drawItems(QPainter *p,
     QRect r = QRect(origRect.x() + bw, origRect.y() + bw,
                     origRect.width() - 2 * bw, origRect.height() - 2 * bw);
 
-    TreeMapItemList *list = item->children();
+    TreeMapItemList *children = item->children();
+    TreeMapLeafArray *leaves = item->leaves();
 
     bool stopDrawing = false;
 
     // only subdivide if there are children
-    if (!list || list->count() == 0) {
+    if ((!children || children->count() == 0) &&
+            (!leaves || leaves->count() == 0)) {
         stopDrawing = true;
     }
 
@@ -2612,6 +3536,12 @@ void TreeMapWidget::drawItems(QPainter *p,
             }
         }
 
+    // progressive drawing: draw children in a later frame
+    if (!stopDrawing && lodStop(item)) {
+        _lodPending.append(item);
+        stopDrawing = true;
+    }
+
     // area size is checked later...
 #if 0
     // stop drawing if minimal area size is reached
@@ -2623,12 +3553,15 @@ void TreeMapWidget::drawItems(QPainter *p,
 #endif
 
     if (stopDrawing) {
-        if (list) {
+        if (children) {
             // invalidate rects
-            foreach (TreeMapItem *i, *list) {
+            foreach (TreeMapItem *i, *children) {
                 i->clearItemRect();
             }
         }
+        if (leaves) {
+            leaves->clearRects();
+        }
         // tooltip appears on whole item rect
         item->addFreeRect(item->itemRect());
 
@@ -2658,13 +3591,17 @@ void TreeMapWidget::drawItems(QPainter *p,
     // user supplied sum
     user_sum = item->sum();
 
+    // children and leaves in drawing order
+    TreeMapLayoutList list;
+    layoutList(item, children, list);
+
     // own sum
     child_sum = 0;
-    foreach (TreeMapItem *i, *list) {
-        child_sum += i->value();
-        if (DEBUG_DRAWING)
-            qDebug() << "  child: " << i->text(0) << ", value "
-                          << i->value() << endl;
+    foreach (const TreeMapLayoutEntry &e, list) {
+        child_sum += e.value;
+        if (DEBUG_DRAWING && e.item)
+            qDebug() << "  child: " << e.item->text(0) << ", value "
+                          << e.value << endl;
     }
 
     QRect orig = r;
@@ -2777,117 +3714,57 @@ void TreeMapWidget::drawItems(QPainter *p,
         // noSorting
         goBack = false;
     }
+    if (goBack) {
+        std::reverse(list.begin(), list.end());
+    }
 
-    int idx = goBack ? (list->size() - 1) : 0;
-
-    if (item->splitMode() == TreeMapItem::Columns) {
-        int len = list->count();
-        bool drawDetails = true;
-
-        while (len > 0 && user_sum > 0) {
-            int firstIdx = idx;
-            double valSum = 0;
-            int lenLeft = len;
-            int columns = (int)(sqrt((double)len * r.width() / r.height()) + .5);
-            if (columns == 0) {
-                columns = 1;    //should never be needed
-            }
+    // rectangles come from TreeMapLayout, here they only get painted
+    QVector<double> values(list.count());
+    for (int k = 0; k < list.count(); k++) {
+        values[k] = list.at(k).value;
+    }
 
-            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
-                                   (double)len * user_sum / columns / columns)) {
-                valSum += list->at(idx)->value();
-                if (goBack) {
-                    --idx;
-                } else {
-                    ++idx;
-                }
-                lenLeft--;
-            }
+    TreeMapLayout layout;
+    layout.setSplitMode((TreeMapLayout::SplitMode)item->splitMode());
+    layout.setVisibleWidth(_visibleWidth);
+    layout.setMinimalArea(_minimalArea);
+    layout.setSorted(item->sorting(0) != -1);
+    layout.setSeparators(_drawSeparators);
 
-            // we always split horizontally
-            int nextPos = (int)((double)r.width() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), nextPos, r.height());
+    QVector<QRect> rects, fills;
+    QVector<QLine> lines;
+    layout.layout(r, values, rects, item->depth(), &fills, &lines);
 
-            if (nextPos < _visibleWidth) {
-                if (item->sorting(0) == -1) {
-                    // fill current rect with hash pattern
-                    drawFill(item, p, firstRect);
-                } else {
-                    // fill rest with hash pattern
-                    drawFill(item, p, r, list, firstIdx, len, goBack);
-                    break;
-                }
+    QVector<int> leafOrder;
+    for (int k = 0; k < list.count(); k++) {
+        const TreeMapLayoutEntry &e = list.at(k);
+        const QRect &currRect = rects.at(k);
+        if (e.item) {
+            e.item->setDrawnValue(e.value);
+            if (currRect.isValid()) {
+                e.item->setItemRect(currRect);
+                drawItems(p, e.item);
             } else {
-                drawDetails = drawItemArray(p, item, firstRect,
-                                            valSum, list, firstIdx, len - lenLeft, goBack);
+                e.item->clearItemRect();
             }
-            r.setRect(r.x() + nextPos, r.y(), r.width() - nextPos, r.height());
-            user_sum -= valSum;
-            len = lenLeft;
-
-            if (!drawDetails) {
-                if (item->sorting(0) == -1) {
-                    drawDetails = true;
-                } else {
-                    drawFill(item, p, r, list, idx, len, goBack);
-                    break;
-                }
+        } else {
+            leaves->setRect(e.leaf, currRect);
+            if (currRect.isValid()) {
+                leafOrder.append(e.leaf);
+                drawLeaf(p, item, e.leaf);
             }
         }
-    } else if (item->splitMode() == TreeMapItem::Rows) {
-        int len = list->count();
-        bool drawDetails = true;
-
-        while (len > 0 && user_sum > 0) {
-            int firstIdx = idx;
-            double valSum = 0;
-            int lenLeft = len;
-            int rows = (int)(sqrt((double)len * r.height() / r.width()) + .5);
-            if (rows == 0) {
-                rows = 1;    //should never be needed
-            }
-
-            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
-                                   (double)len * user_sum / rows / rows)) {
-                valSum += list->at(idx)->value();
-                if (goBack) {
-                    --idx;
-                } else {
-                    ++idx;
-                }
-                lenLeft--;
-            }
-
-            // we always split horizontally
-            int nextPos = (int)((double)r.height() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), r.width(), nextPos);
-
-            if (nextPos < _visibleWidth) {
-                if (item->sorting(0) == -1) {
-                    drawFill(item, p, firstRect);
-                } else {
-                    drawFill(item, p, r, list, firstIdx, len, goBack);
-                    break;
-                }
-            } else {
-                drawDetails = drawItemArray(p, item, firstRect,
-                                            valSum, list, firstIdx, len - lenLeft, goBack);
-            }
-            r.setRect(r.x(), r.y() + nextPos, r.width(), r.height() - nextPos);
-            user_sum -= valSum;
-            len = lenLeft;
+    }
+    if (leaves) {
+        leaves->setLayoutOrder(leafOrder);
+    }
 
-            if (!drawDetails) {
-                if (item->sorting(0) == -1) {
-                    drawDetails = true;
-                } else {
-                    drawFill(item, p, r, list, idx, len, goBack);
-                    break;
-                }
-            }
-        }
-    } else {
-        drawItemArray(p, item, r, user_sum, list, idx, list->count(), goBack);
+    foreach (const QRect &fr, fills) {
+        drawFill(item, p, fr);
+    }
+    if (!lines.isEmpty()) {
+        p->setPen(Qt::black);
+        p->drawLines(lines);
     }
 
     if (DEBUG_DRAWING) {
@@ -2904,240 +3781,6 @@ void TreeMapWidget::drawFill(TreeMapItem *i, QPainter *p, const QRect &r)
     i->addFreeRect(r);
 }
 
-// fills area with a pattern if to small to draw children
-void TreeMapWidget::drawFill(TreeMapItem *i, QPainter *p, const QRect &r,
-                             TreeMapItemList *list, int idx, int len, bool goBack)
-{
-    if (DEBUG_DRAWING)
-        qDebug() << "  +drawFill(" << r.x() << "/" << r.y()
-                      << "-" << r.width() << "x" << r.height()
-                      << ", len " << len << ")" << endl;
-
-    p->setBrush(Qt::Dense4Pattern);
-    p->setPen(Qt::NoPen);
-    p->drawRect(QRect(r.x(), r.y(), r.width() - 1, r.height() - 1));
-    i->addFreeRect(r);
-
-    // reset rects
-    while (len > 0 && (i = list->value(idx))) {
-
-        if (DEBUG_DRAWING) {
-            qDebug() << "   Reset Rect " << i->path(0).join(QStringLiteral("/"));
-        }
-
-        i->clearItemRect();
-        if (goBack) {
-            --idx;
-        } else {
-            ++idx;
-        }
-        len--;
-    }
-    if (DEBUG_DRAWING)
-        qDebug() << "  -drawFill(" << r.x() << "/" << r.y()
-                      << "-" << r.width() << "x" << r.height()
-                      << ", len " << len << ")" << endl;
-}
-
-// returns false if rect gets to small
-bool TreeMapWidget::drawItemArray(QPainter *p, TreeMapItem *item,
-                                  const QRect &r, double user_sum,
-                                  TreeMapItemList *list, int idx, int len,
-                                  bool goBack)
-{
-    if (user_sum == 0) {
-        return false;
-    }
-
-    static bool b2t = true;
-
-    // stop recursive bisection for small rectangles
-    if (((r.height() < _visibleWidth) &&
-            (r.width() < _visibleWidth)) ||
-            ((_minimalArea > 0) &&
-             (r.width() * r.height() < _minimalArea))) {
-
-        drawFill(item, p, r, list, idx, len, goBack);
-        return false;
-    }
-
-    if (DEBUG_DRAWING)
-        qDebug() << " +drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                      << ", " << r.x() << "/" << r.y() << "-" << r.width()
-                      << "x" << r.height() << ")" << endl;
-
-    if (len > 2 && (item->splitMode() == TreeMapItem::Bisection)) {
-
-        int firstIdx = idx;
-        double valSum = 0;
-        int lenLeft = len;
-        //while (lenLeft>0 && valSum<user_sum/2) {
-        while (lenLeft > len / 2) {
-            valSum += list->at(idx)->value();
-            if (goBack) {
-                --idx;
-            } else {
-                ++idx;
-            }
-            lenLeft--;
-        }
-
-        // draw first half...
-        bool drawOn;
-        QRect secondRect;
-
-        if (r.width() > r.height()) {
-            int halfPos = (int)((double)r.width() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), halfPos, r.height());
-            drawOn = drawItemArray(p, item, firstRect,
-                                   valSum, list, firstIdx, len - lenLeft, goBack);
-            secondRect.setRect(r.x() + halfPos, r.y(), r.width() - halfPos, r.height());
-        } else {
-            int halfPos = (int)((double)r.height() * valSum / user_sum);
-            QRect firstRect = QRect(r.x(), r.y(), r.width(), halfPos);
-            drawOn = drawItemArray(p, item, firstRect,
-                                   valSum, list, firstIdx, len - lenLeft, goBack);
-            secondRect.setRect(r.x(), r.y() + halfPos, r.width(), r.height() - halfPos);
-        }
-
-        // if no sorting, do not stop drawing
-        if (item->sorting(0) == -1) {
-            drawOn = true;
-        }
-
-        // second half
-        if (drawOn)
-            drawOn = drawItemArray(p, item, secondRect, user_sum - valSum,
-                                   list, idx, lenLeft, goBack);
-        else {
-            drawFill(item, p, secondRect, list, idx, len, goBack);
-        }
-
-        if (DEBUG_DRAWING)
-            qDebug() << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                          << ")" << endl;
-
-        return drawOn;
-    }
-
-    bool hor = horizontal(item, r);
-
-    TreeMapItem *i;
-    QRect fullRect = r;
-    while (len > 0) {
-        i = list->at(idx);
-        if (user_sum <= 0) {
-
-            if (DEBUG_DRAWING) {
-                qDebug() << "drawItemArray: Reset " << i->path(0).join(QStringLiteral("/"));
-            }
-
-            i->clearItemRect();
-            if (goBack) {
-                --idx;
-            } else {
-                ++idx;
-            }
-            len--;
-            continue;
-        }
-
-        // stop drawing for small rectangles
-        if (((fullRect.height() < _visibleWidth) &&
-                (fullRect.width() < _visibleWidth)) ||
-                ((_minimalArea > 0) &&
-                 (fullRect.width() * fullRect.height() < _minimalArea))) {
-
-            drawFill(item, p, fullRect, list, idx, len, goBack);
-            if (DEBUG_DRAWING)
-                qDebug() << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                              << "): Stop" << endl;
-            return false;
-        }
-
-        if (i->splitMode() == TreeMapItem::AlwaysBest) {
-            hor = fullRect.width() > fullRect.height();
-        }
-
-        int lastPos = hor ? fullRect.width() : fullRect.height();
-        double val = i->value();
-        int nextPos = (user_sum <= 0.0) ? 0 : (int)(lastPos * val / user_sum + .5);
-        if (nextPos > lastPos) {
-            nextPos = lastPos;
-        }
-
-        if ((item->sorting(0) != -1) && (nextPos < _visibleWidth)) {
-            drawFill(item, p, fullRect, list, idx, len, goBack);
-            if (DEBUG_DRAWING)
-                qDebug() << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                              << "): Stop" << endl;
-            return false;
-        }
-
-        QRect currRect = fullRect;
-
-        if (hor) {
-            currRect.setWidth(nextPos);
-        } else {
-            if (b2t) {
-                currRect.setRect(fullRect.x(), fullRect.bottom() - nextPos + 1, fullRect.width(), nextPos);
-            } else {
-                currRect.setHeight(nextPos);
-            }
-        }
-
-        // do not draw very small rectangles:
-        if (nextPos >= _visibleWidth) {
-            i->setItemRect(currRect);
-            drawItems(p, i);
-        } else {
-            i->clearItemRect();
-            drawFill(item, p, currRect);
-        }
-
-        // draw Separator
-        if (_drawSeparators && (nextPos < lastPos)) {
-            p->setPen(Qt::black);
-            if (hor) {
-                if (fullRect.top() <= fullRect.bottom()) {
-                    p->drawLine(fullRect.x() + nextPos, fullRect.top(), fullRect.x() + nextPos, fullRect.bottom());
-                }
-            } else {
-                if (fullRect.left() <= fullRect.right()) {
-                    p->drawLine(fullRect.left(), fullRect.y() + nextPos, fullRect.right(), fullRect.y() + nextPos);
-                }
-            }
-            nextPos++;
-        }
-
-        if (hor)
-            fullRect.setRect(fullRect.x() + nextPos, fullRect.y(),
-                             lastPos - nextPos, fullRect.height());
-        else {
-            if (b2t)
-                fullRect.setRect(fullRect.x(), fullRect.y(),
-                                 fullRect.width(), lastPos - nextPos);
-            else
-                fullRect.setRect(fullRect.x(), fullRect.y() + nextPos,
-                                 fullRect.width(), lastPos - nextPos);
-        }
-
-        user_sum -= val;
-        if (goBack) {
-            --idx;
-        } else {
-            ++idx;
-        }
-        len--;
-    }
-
-    if (DEBUG_DRAWING)
-        qDebug() << " -drawItemArray(" << item->path(0).join(QStringLiteral("/"))
-                      << "): Continue" << endl;
-
-    return true;
-}
-
 /*----------------------------------------------------------------
  * Popup menus for option setting
  */
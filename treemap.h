@@ -40,7 +40,10 @@
 #include <QContextMenuEvent>
 #include <QMenu>
 #include <QMouseEvent>
+#include <QElapsedTimer>
+#include <QSet>
 
+class QTimer;
 class TreeMapWidget;
 class TreeMapItem;
 class TreeMapItemList;
@@ -192,6 +195,9 @@ public:
     }
 
 protected:
+    // estimated heap memory of the fields
+    qint64 fieldMemory() const;
+
     QColor _backColor;
     bool _selected : 1;
     bool _current : 1;
@@ -254,7 +260,9 @@ private:
 
     // temporary
     int _fontHeight;
+    // shared font metrics, owned by the text layout cache
     QFontMetrics *_fm;
+    QString _fontKey;
     DrawParams *_dp;
 };
 
@@ -264,6 +272,132 @@ public:
     TreeMapItem *commonParent();
 };
 
+/**
+ * Selected items.
+ * The list keeps the order of selection. A hash with the position in
+ * the list allows membership checks and removal independent of the
+ * selection size; removed entries are dropped from the list when it
+ * is asked for. Ancestors of selected items are counted, so that
+ * a check for selected items below an item needs no scan.
+ */
+class TreeMapSelection
+{
+public:
+    TreeMapSelection()
+    {
+        _removed = 0;
+    }
+
+    const TreeMapItemList &list() const;
+    int count() const
+    {
+        return _index.count();
+    }
+    bool contains(TreeMapItem *i) const
+    {
+        return _index.contains(i);
+    }
+    // is any item below <i> selected?
+    bool containsBelow(TreeMapItem *i) const
+    {
+        return _below.contains(i);
+    }
+    void append(TreeMapItem *);
+    void remove(TreeMapItem *);
+    void clear();
+
+    bool operator==(const TreeMapSelection &s) const
+    {
+        return list() == s.list();
+    }
+
+private:
+    // removed items are 0 until the list is compacted
+    mutable TreeMapItemList _list;
+    mutable QHash<TreeMapItem *, int> _index;
+    mutable int _removed;
+    // number of selected items below an item
+    QHash<TreeMapItem *, int> _below;
+};
+
+/**
+ * Compact storage for leaf children of an item with a lot of children.
+ *
+ * Instead of one TreeMapItem object per child, only value, name index,
+ * rectangle and flags are stored per leaf in contiguous arrays.
+ * The owning item provides texts and colors for its leaves (see
+ * TreeMapItem::leafText()), and creates a full TreeMapItem for a leaf
+ * when the user interacts with it (see TreeMapItem::materializeLeaf()).
+ * Leaves are laid out together with the children of the owner.
+ */
+class TreeMapLeafArray
+{
+public:
+    enum Flags { Materialized = 1 };
+
+    void reserve(int n);
+    // name index is only interpreted by the owning item
+    void append(double value, int nameIndex);
+    // sort leaves by value, ascending
+    void sort();
+
+    int count() const
+    {
+        return _value.size();
+    }
+    double value(int l) const
+    {
+        return _value[l];
+    }
+    int nameIndex(int l) const
+    {
+        return _nameIndex[l];
+    }
+    const QRect &rect(int l) const
+    {
+        return _rect[l];
+    }
+    void setRect(int l, const QRect &r)
+    {
+        _rect[l] = r;
+    }
+    void clearRects();
+    // leaves with a rectangle in the order they were laid out, for leafAt()
+    void setLayoutOrder(const QVector<int> &order);
+    // leaf whose rectangle contains <p>, or -1
+    int leafAt(const QPoint &p) const;
+
+    // a materialized leaf is a child item and not laid out as leaf
+    bool isMaterialized(int l) const
+    {
+        return _flags[l] & Materialized;
+    }
+    void setMaterialized(int l)
+    {
+        _flags[l] |= Materialized;
+    }
+
+    // estimated heap memory of the arrays
+    qint64 memoryUsage() const;
+
+private:
+    QVector<double> _value;
+    QVector<int> _nameIndex;
+    QVector<QRect> _rect;
+    QVector<uchar> _flags;
+    // layout order, and bounding rectangle of the leaves from there on
+    QVector<int> _order;
+    QVector<QRect> _reach;
+};
+
+/* Entry for layout: either a child item or a leaf of the parent */
+struct TreeMapLayoutEntry {
+    TreeMapItem *item;
+    int leaf;
+    double value;
+};
+typedef QVector<TreeMapLayoutEntry> TreeMapLayoutList;
+
 /**
  * Base class of items in TreeMap.
  *
@@ -336,8 +470,12 @@ public:
 
     /**
      * Depth of this item. This is the distance to root.
+     * Set when the item is inserted, so this is cheap.
      */
-    int depth() const;
+    int depth() const
+    {
+        return _depth;
+    }
 
     /**
      * Parent Item
@@ -414,6 +552,38 @@ public:
         _value = s;
     }
 
+    /**
+     * value() at the time this item was laid out the last time.
+     * Allows to check if a value change moves rectangles.
+     */
+    double drawnValue() const
+    {
+        return _drawnValue;
+    }
+    void setDrawnValue(double v)
+    {
+        _drawnValue = v;
+    }
+
+    /**
+     * Set when laying out: true if this item or a parent is
+     * selected (or marked) / current. Children get their state from
+     * the parent instead of searching the selection.
+     */
+    bool inSelection() const
+    {
+        return _inSelection;
+    }
+    bool inCurrent() const
+    {
+        return _inCurrent;
+    }
+    void setInSelection(bool selected, bool current)
+    {
+        _inSelection = selected;
+        _inCurrent = current;
+    }
+
     virtual double sum() const;
     virtual double value() const;
     // replace "Default" position with setting from TreeMapWidget
@@ -456,8 +626,37 @@ public:
     // not const as this can create children on demand
     virtual TreeMapItemList *children();
 
+    /**
+     * Compact leaf children, laid out together with children().
+     * Set up by reimplementations of children(); 0 if not used.
+     * With value sorting, leaves are merged into the children
+     * by value, otherwise they are laid out after the children.
+     */
+    TreeMapLeafArray *leaves() const
+    {
+        return _leaves;
+    }
+
+    // texts and color for a leaf; defaults give no text, own color
+    virtual QString leafText(int leaf, int textNo) const;
+    virtual QColor leafBackColor(int leaf) const;
+
+    /**
+     * Create a full child item for a leaf, e.g. for selection.
+     * The default returns 0, i.e. leaves can not be selected.
+     */
+    virtual TreeMapItem *materializeLeaf(int leaf);
+
+    /**
+     * Estimated memory of this item and all items below, including
+     * fields, child lists and leaf arrays. Reimplement to add the
+     * data of a subclass.
+     */
+    virtual qint64 memoryUsage() const;
+
 protected:
     TreeMapItemList *_children;
+    TreeMapLeafArray *_leaves;
     double _sum, _value;
 
 private:
@@ -472,11 +671,16 @@ private:
     QList<QRect> _freeRects;
     int _depth;
 
-    // temporary self value (when using level skipping)
-    double _unused_self;
+    // value() at the time of the last layout
+    double _drawnValue;
+    bool _inSelection, _inCurrent;
 
     // index of last active subitem
     int _index;
+
+    void deleteChildren();
+    void setDepth(int);
+    void sortChildren();
 };
 
 /**
@@ -608,6 +812,16 @@ public:
         return _shading;
     }
 
+    /*
+     * Rectangle backgrounds drawn at all? Without, only the fields
+     * of items are drawn (used to measure layout costs).
+     */
+    void setBackgroundEnabled(bool b);
+    bool isBackgroundEnabled() const
+    {
+        return _background;
+    }
+
     /* Setting for a whole depth level: draw 3D frame (default) or solid */
     void drawFrame(int d, bool b);
     bool drawFrame(int d) const
@@ -632,6 +846,10 @@ public:
      * at this level.
      */
     void setVisibleWidth(int width, bool reuseSpace = false);
+    int visibleWidth() const
+    {
+        return _visibleWidth;
+    }
 
     /**
      * If a children value() is almost the parents sum(),
@@ -668,6 +886,30 @@ public:
         return _minimalArea;
     }
 
+    /**
+     * Progressive drawing: a full redraw first only draws the top
+     * levels, and deeper levels are refined in following frames.
+     * Every frame stops descending when the drawing budget (in ms)
+     * is used up; the remaining items are refined in the next frame.
+     * maxDrawingDepth() and minimalArea() stay the final limits.
+     */
+    void setProgressiveDrawing(bool enable);
+    bool progressiveDrawing() const
+    {
+        return _progressive;
+    }
+    void setDrawingBudget(int ms);
+    int drawingBudget() const
+    {
+        return _drawingBudget;
+    }
+
+    /**
+     * Drop any pending refinement and start again with the top levels.
+     * Call this on navigation to get a responsive first frame.
+     */
+    void restartProgressiveDrawing();
+
     /* defaults for text attributes */
     QString defaultFieldType(int) const;
     QString defaultFieldStop(int) const;
@@ -751,7 +993,7 @@ public:
     }
     TreeMapItemList selection() const
     {
-        return _selection;
+        return _selection.list();
     }
     bool isSelected(TreeMapItem *i) const;
     int maxSelectDepth() const
@@ -779,6 +1021,15 @@ public:
         redraw(_base);
     }
 
+    /**
+     * Redraws an item with all children, like redraw(TreeMapItem*),
+     * but without merging with other pending redraws into a common
+     * parent: each damaged item is laid out again on its own, and
+     * only its area gets repainted. The item rectangle must stay the
+     * same, i.e. value changes must not move the item itself.
+     */
+    void redrawDamaged(TreeMapItem *);
+
     /**
      * Resort all TreeMapItems. See TreeMapItem::resort().
      */
@@ -792,6 +1043,11 @@ public:
 
     // used internally when items are destroyed
     void deletingItem(TreeMapItem *);
+    /* Used internally before/after deleting all items below an item:
+     * references are removed in one pass instead of one per item.
+     * Returns false if already inside of such a bulk deletion. */
+    bool deletingChildren(TreeMapItem *);
+    void deletedChildren();
 
 protected slots:
     void splitActivated(QAction *);
@@ -800,6 +1056,7 @@ protected slots:
     void areaStopActivated(QAction *);
     void depthStopActivated(QAction *);
     void visualizationActivated(QAction *a);
+    void refineDrawing();
 
 signals:
     void selectionChanged();
@@ -816,6 +1073,11 @@ signals:
     void doubleClicked(TreeMapItem *);
     void rightButtonPressed(TreeMapItem *, const QPoint &);
     void contextMenuRequested(TreeMapItem *, const QPoint &);
+    /**
+     * All visible items have their rectangles: emitted after a redraw
+     * without postponed items, or when progressive drawing is done.
+     */
+    void layoutFinished();
 
 protected:
     void mousePressEvent(QMouseEvent *) Q_DECL_OVERRIDE;
@@ -833,7 +1095,7 @@ protected:
     void addPopupItem(QMenu *popup, const QString &text,
                       bool bChecked, int id, bool bEnabled = true);
 private:
-    TreeMapItemList diff(TreeMapItemList &, TreeMapItemList &);
+    TreeMapItemList diff(const TreeMapSelection &, const TreeMapSelection &);
     // returns true if selection changed
     TreeMapItem *setTmpSelected(TreeMapItem *, bool selected = true);
     TreeMapItem *setTmpRangeSelection(TreeMapItem *i1,
@@ -842,16 +1104,15 @@ private:
 
     void drawItem(QPainter *p, TreeMapItem *);
     void drawItems(QPainter *p, TreeMapItem *);
-    bool horizontal(TreeMapItem *i, const QRect &r);
     void drawFill(TreeMapItem *, QPainter *p, const QRect &r);
-    void drawFill(TreeMapItem *, QPainter *p, const QRect &r,
-                  TreeMapItemList *list, int idx, int len, bool goBack);
-    bool drawItemArray(QPainter *p, TreeMapItem *, const QRect &r, double,
-                       TreeMapItemList *list, int idx, int len, bool);
+    void drawLeaf(QPainter *p, TreeMapItem *, int leaf);
     bool resizeAttr(int);
+    bool lodStop(TreeMapItem *);
 
     TreeMapItem *_base;
     TreeMapItem *_current, *_lastOver, *_oldCurrent;
+    // item whose children are deleted at the moment
+    TreeMapItem *_deletingBelow;
     int _maxSelectDepth, _maxDrawingDepth;
 
     // attributes for field, per textNo
@@ -866,10 +1127,12 @@ private:
     TreeMapItem::SplitMode _splitMode;
     int _visibleWidth, _stopArea, _minimalArea, _borderWidth;
     bool _reuseSpace, _skipIncorrectBorder, _drawSeparators, _shading;
+    bool _background;
     bool _allowRotation;
     bool _transparent[4], _drawFrame[4];
     TreeMapItem *_needsRefresh;
-    TreeMapItemList _selection;
+    TreeMapItemList _damaged;
+    TreeMapSelection _selection;
     int _markNo;
 
     // for the context menus: start IDs
@@ -879,7 +1142,7 @@ private:
 
     // temporary selection while dragging, used for drawing
     // most of the time, _selection == _tmpSelection
-    TreeMapItemList _tmpSelection;
+    TreeMapSelection _tmpSelection;
     bool _inShiftDrag, _inControlDrag;
 
     // temporary widget font metrics while drawing
@@ -888,6 +1151,14 @@ private:
 
     // back buffer pixmap
     QPixmap _pixmap;
+
+    // progressive drawing: items drawn without children because of
+    // the level of detail limits, to be refined in the next frame
+    bool _progressive, _lodActive;
+    int _drawingBudget, _lodDepth, _lodStopDepth;
+    QElapsedTimer _lodClock;
+    QTimer *_lodTimer;
+    TreeMapItemList _lodPending;
 };
 
 #endif
@@ -0,0 +1,260 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+#include "treemaplayout.h"
+
+#include <math.h>
+
+// TreeMapLayout
+
+TreeMapLayout::TreeMapLayout()
+{
+    _splitMode = AlwaysBest;
+    _visibleWidth = 2;
+    _minimalArea = -1;
+    _sorted = true;
+    _separators = false;
+}
+
+bool TreeMapLayout::tooSmall(const QRect &r) const
+{
+    return ((r.height() < _visibleWidth) && (r.width() < _visibleWidth)) ||
+           ((_minimalArea > 0) && (r.width() * r.height() < _minimalArea));
+}
+
+bool TreeMapLayout::horizontal(const QRect &r, int depth) const
+{
+    switch (_splitMode) {
+    case HAlternate:
+        return (depth % 2) == 1;
+    case VAlternate:
+        return (depth % 2) == 0;
+    case Horizontal:
+        return true;
+    case Vertical:
+        return false;
+    default:
+        return r.width() > r.height();
+    }
+    return false;
+}
+
+int TreeMapLayout::layout(const QRect &rect, const QVector<double> &values,
+                          QVector<QRect> &rects, int depth,
+                          QVector<QRect> *fills, QVector<QLine> *lines) const
+{
+    rects.fill(QRect(), values.count());
+
+    double sum = 0;
+    foreach (double v, values) {
+        sum += v;
+    }
+    if ((sum <= 0) || !rect.isValid()) {
+        return 0;
+    }
+
+    QRect r = rect;
+    if ((_splitMode == Columns) || (_splitMode == Rows)) {
+        bool columns = (_splitMode == Columns);
+        int idx = 0, len = values.count();
+
+        while (len > 0 && sum > 0 && r.width() > 0 && r.height() > 0) {
+            int firstIdx = idx;
+            double valSum = 0;
+            int lenLeft = len;
+            int lineCount = (int)(sqrt(columns ? (double)len * r.width() / r.height() :
+                                       (double)len * r.height() / r.width()) + .5);
+            if (lineCount == 0) {
+                lineCount = 1;
+            }
+
+            while (lenLeft > 0 && ((double)valSum * (len - lenLeft) <
+                                   (double)len * sum / lineCount / lineCount)) {
+                valSum += values[idx++];
+                lenLeft--;
+            }
+
+            int nextPos = (int)((double)(columns ? r.width() : r.height()) * valSum / sum);
+            QRect firstRect = columns ? QRect(r.x(), r.y(), nextPos, r.height()) :
+                              QRect(r.x(), r.y(), r.width(), nextPos);
+
+            bool drawOn;
+            if (nextPos < _visibleWidth) {
+                // the rest is even smaller
+                if (fills) {
+                    fills->append(_sorted ? r : firstRect);
+                }
+                if (_sorted) {
+                    break;
+                }
+                drawOn = true;
+            } else {
+                drawOn = layoutArray(firstRect, valSum, values,
+                                     firstIdx, len - lenLeft, depth, rects, fills, lines);
+            }
+
+            if (columns) {
+                r.setRect(r.x() + nextPos, r.y(), r.width() - nextPos, r.height());
+            } else {
+                r.setRect(r.x(), r.y() + nextPos, r.width(), r.height() - nextPos);
+            }
+            sum -= valSum;
+            len = lenLeft;
+
+            if (!drawOn && _sorted) {
+                if (fills) {
+                    fills->append(r);
+                }
+                break;
+            }
+        }
+    } else {
+        layoutArray(r, sum, values, 0, values.count(), depth, rects, fills, lines);
+    }
+
+    int count = 0;
+    foreach (const QRect &rc, rects) {
+        if (rc.isValid()) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// returns false if rect gets to small
+bool TreeMapLayout::layoutArray(const QRect &r, double sum,
+                                const QVector<double> &values,
+                                int idx, int len, int depth,
+                                QVector<QRect> &rects,
+                                QVector<QRect> *fills, QVector<QLine> *lines) const
+{
+    if (sum == 0) {
+        return false;
+    }
+    if (tooSmall(r)) {
+        if (fills) {
+            fills->append(r);
+        }
+        return false;
+    }
+
+    if (len > 2 && (_splitMode == Bisection)) {
+        int firstIdx = idx;
+        double valSum = 0;
+        int lenLeft = len;
+        while (lenLeft > len / 2) {
+            valSum += values[idx++];
+            lenLeft--;
+        }
+
+        bool drawOn;
+        QRect secondRect;
+        if (r.width() > r.height()) {
+            int halfPos = (int)((double)r.width() * valSum / sum);
+            drawOn = layoutArray(QRect(r.x(), r.y(), halfPos, r.height()),
+                                 valSum, values, firstIdx, len - lenLeft, depth,
+                                 rects, fills, lines);
+            secondRect.setRect(r.x() + halfPos, r.y(), r.width() - halfPos, r.height());
+        } else {
+            int halfPos = (int)((double)r.height() * valSum / sum);
+            drawOn = layoutArray(QRect(r.x(), r.y(), r.width(), halfPos),
+                                 valSum, values, firstIdx, len - lenLeft, depth,
+                                 rects, fills, lines);
+            secondRect.setRect(r.x(), r.y() + halfPos, r.width(), r.height() - halfPos);
+        }
+
+        if (!_sorted) {
+            drawOn = true;
+        }
+        if (drawOn) {
+            drawOn = layoutArray(secondRect, sum - valSum, values, idx, lenLeft, depth,
+                                 rects, fills, lines);
+        } else if (fills) {
+            fills->append(secondRect);
+        }
+        return drawOn;
+    }
+
+    bool hor = horizontal(r, depth);
+    QRect fullRect = r;
+    while (len > 0 && sum > 0) {
+        if (tooSmall(fullRect)) {
+            if (fills) {
+                fills->append(fullRect);
+            }
+            return false;
+        }
+
+        if (_splitMode == AlwaysBest) {
+            hor = fullRect.width() > fullRect.height();
+        }
+
+        int lastPos = hor ? fullRect.width() : fullRect.height();
+        double val = values[idx];
+        int nextPos = (int)(lastPos * val / sum + .5);
+        if (nextPos > lastPos) {
+            nextPos = lastPos;
+        }
+        if (_sorted && (nextPos < _visibleWidth)) {
+            if (fills) {
+                fills->append(fullRect);
+            }
+            return false;
+        }
+
+        // vertical splits go from bottom to top
+        QRect currRect;
+        if (hor) {
+            currRect.setRect(fullRect.x(), fullRect.y(), nextPos, fullRect.height());
+        } else {
+            currRect.setRect(fullRect.x(), fullRect.bottom() - nextPos + 1,
+                             fullRect.width(), nextPos);
+        }
+        if (nextPos >= _visibleWidth) {
+            rects[idx] = currRect;
+        } else if (fills) {
+            fills->append(currRect);
+        }
+
+        if (_separators && (nextPos < lastPos)) {
+            if (lines) {
+                if (hor) {
+                    lines->append(QLine(currRect.right() + 1, fullRect.top(),
+                                        currRect.right() + 1, fullRect.bottom()));
+                } else {
+                    lines->append(QLine(fullRect.left(), currRect.top() - 1,
+                                        fullRect.right(), currRect.top() - 1));
+                }
+            }
+            nextPos++;
+        }
+
+        if (hor) {
+            fullRect.setRect(fullRect.x() + nextPos, fullRect.y(),
+                             lastPos - nextPos, fullRect.height());
+        } else {
+            fullRect.setRect(fullRect.x(), fullRect.y(),
+                             fullRect.width(), lastPos - nextPos);
+        }
+
+        sum -= val;
+        idx++;
+        len--;
+    }
+
+    return true;
+}
@@ -0,0 +1,122 @@
+/* This file is part of FSView.
+
+   KCachegrind is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public
+   License as published by the Free Software Foundation, version 2.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; see the file COPYING.  If not, write to
+   the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+   Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Treemap layout without widgets
+ */
+
+#ifndef TREEMAPLAYOUT_H
+#define TREEMAPLAYOUT_H
+
+#include <QLine>
+#include <QRect>
+#include <QVector>
+
+/**
+ * Splits a rectangle among a list of values. TreeMapWidget uses this
+ * for the rectangles of the children of an item, and only paints them.
+ * Space for text fields and borders is left to the caller.
+ * Only needs QtCore.
+ *
+ * For a whole tree, call layout() again with the rectangle of each
+ * child (minus a border, if wanted) and depth + 1.
+ */
+class TreeMapLayout
+{
+public:
+    // same order as TreeMapItem::SplitMode
+    enum SplitMode { Bisection, Columns, Rows,
+                     AlwaysBest, Best,
+                     HAlternate, VAlternate,
+                     Horizontal, Vertical
+                   };
+
+    TreeMapLayout();
+
+    void setSplitMode(SplitMode m)
+    {
+        _splitMode = m;
+    }
+    SplitMode splitMode() const
+    {
+        return _splitMode;
+    }
+
+    // rectangles below this width in both directions are not laid out
+    void setVisibleWidth(int w)
+    {
+        _visibleWidth = w;
+    }
+    int visibleWidth() const
+    {
+        return _visibleWidth;
+    }
+    void setMinimalArea(int a)
+    {
+        _minimalArea = a;
+    }
+    int minimalArea() const
+    {
+        return _minimalArea;
+    }
+
+    /* With values sorted by decreasing size, layout stops at the
+     * first value too small to be shown. */
+    void setSorted(bool s)
+    {
+        _sorted = s;
+    }
+    bool sorted() const
+    {
+        return _sorted;
+    }
+
+    // leave a line of one pixel after each rectangle
+    void setSeparators(bool s)
+    {
+        _separators = s;
+    }
+    bool separators() const
+    {
+        return _separators;
+    }
+
+    /**
+     * Lays out <values> in <r>, in the given order. <rects> gets one
+     * rectangle per value, invalid if the value is too small to be
+     * shown. <depth> is used by the alternating split modes.
+     * If given, <fills> gets the areas of values too small to be shown,
+     * and <lines> the separators.
+     * Returns the number of valid rectangles.
+     */
+    int layout(const QRect &r, const QVector<double> &values,
+               QVector<QRect> &rects, int depth = 1,
+               QVector<QRect> *fills = 0, QVector<QLine> *lines = 0) const;
+
+private:
+    bool layoutArray(const QRect &r, double sum, const QVector<double> &values,
+                     int idx, int len, int depth, QVector<QRect> &rects,
+                     QVector<QRect> *fills, QVector<QLine> *lines) const;
+    bool horizontal(const QRect &r, int depth) const;
+    bool tooSmall(const QRect &r) const;
+
+    SplitMode _splitMode;
+    int _visibleWidth, _minimalArea;
+    bool _sorted, _separators;
+};
+
+#endif // TREEMAPLAYOUT_H